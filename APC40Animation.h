@@ -0,0 +1,381 @@
+#pragma once
+
+#include "APC40Interface.h"
+
+// ------------------------------------------------------------
+/*
+
+Keyframe animation engine for LEDs, knob rings and knob modes.
+
+A track animates a single control or a group of controls (ie. a pad region) through a list of keyframes.
+Playing tracks are kept in a heap ordered by the time their output changes next, so a tick only
+evaluates the tracks that are actually due. Linear segments output the interpolated value truncated
+to whole steps, and are scheduled for the next time that value changes, not for every tick.
+
+All storage is preallocated, adding tracks and ticking never allocates.
+
+Usage:
+
+APC40Animator animator;
+
+const APC40Keyframe pulse[] =
+{
+    { 0, 0, eAPC40Interpolation::Linear },
+    { 500, 127, eAPC40Interpolation::Linear },
+    { 1000, 0, eAPC40Interpolation::Hold }
+};
+
+int track = animator.AddTrack(APC40PackControl(eAPC40Control::TrackKnobValue, 0), pulse, 3, true);
+animator.Start(track, now);
+
+// Every frame
+animator.Tick(apc40, now);
+
+*/
+// ------------------------------------------------------------
+
+constexpr size_t APC40_MAX_ANIMATION_TRACKS = 256;
+constexpr size_t APC40_MAX_ANIMATION_KEYFRAMES = 4096;
+
+// How a keyframe's segment (until the next keyframe) is evaluated.
+enum class eAPC40Interpolation
+{
+    Hold = 0, // Keeps the keyframe's value
+    Step,     // Jumps to the next keyframe's value right away
+    Linear    // Interpolates towards the next keyframe's value
+};
+
+struct APC40Keyframe
+{
+    uint32_t time = 0; // ms since the track was started
+    unsigned char value = 0;
+    eAPC40Interpolation interpolation = eAPC40Interpolation::Hold;
+};
+
+// Returns true if time a is before time b, both in ms of a wrapping clock.
+constexpr bool APC40TimeBefore(uint32_t a, uint32_t b)
+{
+    return static_cast<int32_t>(a - b) < 0;
+}
+
+// ------------------------------------------------------------
+
+class APC40Animator
+{
+public:
+
+    APC40Animator()
+    {
+
+    }
+
+    ~APC40Animator()
+    {
+
+    }
+
+    // ------------------------------------------------------------ Setup
+
+    // Adds a track for a single control. keyframes are copied and must be sorted by time.
+    // Looping tracks restart after the last keyframe. Returns the track id, or -1 if the storage is full.
+    int AddTrack(eAPC40Control control, const APC40Keyframe* keyframes, size_t count, bool loop = false)
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return -1;
+
+        APC40ControlMask mask{};
+        mask.Set(static_cast<size_t>(control));
+
+        return AddTrack(mask, keyframes, count, loop);
+    }
+
+    // Adds a track that sets all controls in mask, ie. APC40PadRectMask.
+    int AddTrack(const APC40ControlMask& mask, const APC40Keyframe* keyframes, size_t count, bool loop = false)
+    {
+        APC40ControlMask controls{ mask & ~APC40ControlMaskFrom(APC40_NUM_CONTROLS) };
+
+        if (!controls.Any() || count == 0 || m_NumTracks >= APC40_MAX_ANIMATION_TRACKS || m_NumKeyframes + count > APC40_MAX_ANIMATION_KEYFRAMES)
+            return -1;
+
+        for (size_t n = 1; n < count; ++n)
+        {
+            if (keyframes[n].time < keyframes[n - 1].time)
+                return -1;
+        }
+
+        Track& track{ m_Tracks[m_NumTracks] };
+
+        track = Track{};
+        track.controls = controls;
+        track.first_keyframe = static_cast<unsigned int>(m_NumKeyframes);
+        track.num_keyframes = static_cast<unsigned int>(count);
+        track.loop = loop && keyframes[count - 1].time > 0;
+
+        for (size_t n = 0; n < count; ++n)
+        {
+            m_Keyframes[m_NumKeyframes + n] = keyframes[n];
+            m_Keyframes[m_NumKeyframes + n].value = std::min<unsigned char>(keyframes[n].value, 127);
+        }
+
+        m_NumKeyframes += count;
+
+        return static_cast<int>(m_NumTracks++);
+    }
+
+    int AddPadRectTrack(int x, int y, int width, int height, const APC40Keyframe* keyframes, size_t count, bool loop = false)
+    {
+        return AddTrack(APC40PadRectMask(x, y, width, height), keyframes, count, loop);
+    }
+
+    // Removes all tracks and keyframes.
+    void Clear()
+    {
+        m_NumTracks = 0;
+        m_NumKeyframes = 0;
+        m_HeapSize = 0;
+    }
+
+    // ------------------------------------------------------------ Playback
+
+    // Starts (or restarts) a track at time now (ms).
+    bool Start(int id, uint32_t now)
+    {
+        if (id < 0 || static_cast<size_t>(id) >= m_NumTracks)
+            return false;
+
+        Track& track{ m_Tracks[id] };
+
+        track.start = now;
+        track.cursor = 0;
+        track.last_value = 0xFFFF;
+        track.next_time = now + m_Keyframes[track.first_keyframe].time;
+
+        if (track.heap_index < 0)
+            HeapPush(id);
+        else
+            HeapUpdate(track.heap_index);
+
+        return true;
+    }
+
+    // Stops a track, its controls keep their current values.
+    bool Stop(int id)
+    {
+        if (id < 0 || static_cast<size_t>(id) >= m_NumTracks || m_Tracks[id].heap_index < 0)
+            return false;
+
+        HeapRemove(m_Tracks[id].heap_index);
+
+        return true;
+    }
+
+    bool IsPlaying(int id) const
+    {
+        return id >= 0 && static_cast<size_t>(id) < m_NumTracks && m_Tracks[id].heap_index >= 0;
+    }
+
+    // Evaluates the tracks that are due at time now (ms) and writes their values into the interface's desired state.
+    // Returns the number of evaluated tracks.
+    unsigned int Tick(APC40Interface& apc40, uint32_t now)
+    {
+        unsigned int num_evaluated{ 0 };
+
+        while (m_HeapSize > 0 && !APC40TimeBefore(now, m_Tracks[m_Heap[0]].next_time))
+        {
+            int id{ m_Heap[0] };
+
+            ++num_evaluated;
+
+            if (Evaluate(apc40, m_Tracks[id], now))
+                HeapUpdate(0);
+            else
+                HeapRemove(0);
+        }
+
+        return num_evaluated;
+    }
+
+    size_t GetNumPlaying() const
+    {
+        return m_HeapSize;
+    }
+
+private:
+
+    struct Track
+    {
+        APC40ControlMask controls;
+
+        unsigned int first_keyframe = 0;
+        unsigned int num_keyframes = 0;
+        unsigned int cursor = 0; // Keyframe the current segment starts at
+
+        uint32_t start = 0;
+        uint32_t next_time = 0;
+
+        unsigned int last_value = 0xFFFF;
+
+        int heap_index = -1;
+        bool loop = false;
+    };
+
+    // Writes the track's value at time now and schedules its next change. Returns false once the track has finished.
+    bool Evaluate(APC40Interface& apc40, Track& track, uint32_t now)
+    {
+        const APC40Keyframe* keyframes{ &m_Keyframes[track.first_keyframe] };
+        const APC40Keyframe& last{ keyframes[track.num_keyframes - 1] };
+
+        uint32_t elapsed{ now - track.start };
+
+        if (track.loop && elapsed >= last.time)
+        {
+            uint32_t loops{ elapsed / last.time };
+
+            track.start += loops * last.time;
+            track.cursor = 0;
+            elapsed -= loops * last.time;
+        }
+
+        if (elapsed >= last.time)
+        {
+            Write(apc40, track, last.value);
+            return false;
+        }
+
+        if (elapsed < keyframes[0].time)
+        {
+            track.next_time = track.start + keyframes[0].time;
+            return true;
+        }
+
+        while (keyframes[track.cursor + 1].time <= elapsed)
+            ++track.cursor;
+
+        const APC40Keyframe& from{ keyframes[track.cursor] };
+        const APC40Keyframe& to{ keyframes[track.cursor + 1] };
+
+        track.next_time = track.start + to.time;
+
+        switch (from.interpolation)
+        {
+        case eAPC40Interpolation::Hold:
+            Write(apc40, track, from.value);
+            break;
+
+        case eAPC40Interpolation::Step:
+            Write(apc40, track, to.value);
+            break;
+
+        case eAPC40Interpolation::Linear:
+        {
+            int delta{ static_cast<int>(to.value) - static_cast<int>(from.value) };
+            uint32_t magnitude{ static_cast<uint32_t>(std::abs(delta)) };
+            uint32_t duration{ to.time - from.time };
+            uint32_t offset{ elapsed - from.time };
+
+            // Number of whole steps taken so far, and the time the next one is due
+            uint32_t steps{ static_cast<uint32_t>(static_cast<uint64_t>(magnitude) * offset / duration) };
+            uint32_t next_offset{ static_cast<uint32_t>((static_cast<uint64_t>(steps + 1) * duration + magnitude - 1) / std::max(magnitude, 1u)) };
+
+            Write(apc40, track, static_cast<unsigned int>(from.value + (delta < 0 ? -static_cast<int>(steps) : static_cast<int>(steps))));
+
+            if (steps < magnitude && next_offset < duration)
+                track.next_time = track.start + from.time + next_offset;
+
+            break;
+        }
+        }
+
+        return true;
+    }
+
+    void Write(APC40Interface& apc40, Track& track, unsigned int value)
+    {
+        if (track.last_value == value)
+            return;
+
+        track.last_value = value;
+
+        track.controls.ForEach([&](size_t i)
+        {
+            apc40.SetControlValue(static_cast<eAPC40Control>(i), static_cast<int>(value));
+        });
+    }
+
+    // ------------------------------------------------------------ Heap
+
+    bool HeapLess(size_t a, size_t b) const
+    {
+        return APC40TimeBefore(m_Tracks[m_Heap[a]].next_time, m_Tracks[m_Heap[b]].next_time);
+    }
+
+    void HeapSwap(size_t a, size_t b)
+    {
+        std::swap(m_Heap[a], m_Heap[b]);
+
+        m_Tracks[m_Heap[a]].heap_index = static_cast<int>(a);
+        m_Tracks[m_Heap[b]].heap_index = static_cast<int>(b);
+    }
+
+    void HeapPush(int id)
+    {
+        m_Heap[m_HeapSize] = id;
+        m_Tracks[id].heap_index = static_cast<int>(m_HeapSize);
+
+        HeapUpdate(m_HeapSize++);
+    }
+
+    void HeapRemove(size_t index)
+    {
+        m_Tracks[m_Heap[index]].heap_index = -1;
+
+        if (index != --m_HeapSize)
+        {
+            m_Heap[index] = m_Heap[m_HeapSize];
+            m_Tracks[m_Heap[index]].heap_index = static_cast<int>(index);
+
+            HeapUpdate(index);
+        }
+    }
+
+    // Restores the heap order after the entry at index changed its time.
+    void HeapUpdate(size_t index)
+    {
+        while (index > 0 && HeapLess(index, (index - 1) / 2))
+        {
+            HeapSwap(index, (index - 1) / 2);
+            index = (index - 1) / 2;
+        }
+
+        for (;;)
+        {
+            size_t smallest{ index };
+            size_t left{ index * 2 + 1 };
+            size_t right{ left + 1 };
+
+            if (left < m_HeapSize && HeapLess(left, smallest))
+                smallest = left;
+
+            if (right < m_HeapSize && HeapLess(right, smallest))
+                smallest = right;
+
+            if (smallest == index)
+                break;
+
+            HeapSwap(index, smallest);
+            index = smallest;
+        }
+    }
+
+    Track m_Tracks[APC40_MAX_ANIMATION_TRACKS];
+    size_t m_NumTracks{ 0 };
+
+    APC40Keyframe m_Keyframes[APC40_MAX_ANIMATION_KEYFRAMES];
+    size_t m_NumKeyframes{ 0 };
+
+    // Playing tracks, ordered by next_time.
+    int m_Heap[APC40_MAX_ANIMATION_TRACKS];
+    size_t m_HeapSize{ 0 };
+};
+
+// ------------------------------------------------------------ EOF
@@ -0,0 +1,466 @@
+#pragma once
+
+#include <vector>
+
+#include "APC40Interface.h"
+#include "APC40MappedFile.h"
+
+// ------------------------------------------------------------
+/*
+
+Precompiled animation clips.
+
+A clip is a sequence of frames. Every frame is stored as a list of (control, value) deltas against the
+previous frame, plus the same changes pre-encoded as midi messages. Every keyframe_interval frames a
+full snapshot of the state is stored, so seeking only has to apply a few deltas.
+
+Clips are baked offline with APC40ClipRecorder (see examples/ClipConverter.cpp) and played back
+memory mapped with APC40ClipPlayer. Playback reads straight from the mapping, nothing is copied
+or allocated, and only the pages of the frames that are played are touched.
+
+File layout (native byte order):
+
+APC40ClipHeader
+uint32_t delta_index[num_frames + 1]  // Index of the first delta of each frame
+uint32_t midi_index[num_frames + 1]   // Offset of the first midi byte of each frame
+unsigned char snapshots[num_snapshots][APC40_NUM_CONTROLS]
+APC40ClipDelta deltas[]
+unsigned char midi[]
+
+Usage:
+
+APC40ClipPlayer player;
+player.Open("show.apc40clip");
+
+// Every frame
+player.PlayTo(apc40, frame);
+
+// Or, if the clip owns the device, send the pre-encoded midi instead.
+// This records the frame's changes as sent, so the interface stays in sync with the device.
+const unsigned char* midi = player.PrepareFrameMidi(apc40, frame, midi_size);
+
+*/
+// ------------------------------------------------------------
+
+constexpr uint32_t APC40_CLIP_MAGIC = 0x43435041; // "APCC"
+constexpr uint32_t APC40_CLIP_VERSION = 1;
+constexpr uint32_t APC40_CLIP_NO_FRAME = 0xFFFFFFFF;
+
+struct APC40ClipHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_controls;      // APC40_NUM_CONTROLS when the clip was baked
+
+    uint32_t num_frames;
+    uint32_t frame_duration;    // Microseconds per frame
+    uint32_t keyframe_interval; // Frames per snapshot
+    uint32_t num_snapshots;
+
+    // Byte offsets of the sections
+    uint32_t delta_index_offset;
+    uint32_t midi_index_offset;
+    uint32_t snapshot_offset;
+    uint32_t delta_offset;
+    uint32_t midi_offset;
+    uint32_t file_size;
+};
+
+struct APC40ClipDelta
+{
+    unsigned char control;
+    unsigned char value;
+};
+
+// ------------------------------------------------------------
+
+class APC40ClipPlayer
+{
+public:
+
+    APC40ClipPlayer()
+    {
+
+    }
+
+    ~APC40ClipPlayer()
+    {
+
+    }
+
+    bool Open(const char* path)
+    {
+        Close();
+
+        if (!m_File.Open(path, 0, false))
+            return false;
+
+        if (!Validate())
+        {
+            Close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void Close()
+    {
+        m_File.Close();
+
+        m_Header = nullptr;
+        m_Frame = APC40_CLIP_NO_FRAME;
+    }
+
+    bool IsOpen() const
+    {
+        return m_Header != nullptr;
+    }
+
+    uint32_t GetNumFrames() const
+    {
+        return m_Header ? m_Header->num_frames : 0;
+    }
+
+    // Microseconds per frame.
+    uint32_t GetFrameDuration() const
+    {
+        return m_Header ? m_Header->frame_duration : 0;
+    }
+
+    // ------------------------------------------------------------ Playback
+
+    // Brings the interface's desired state to the given frame. Frames shortly after the last one
+    // are reached by applying their deltas, anything else seeks via the nearest snapshot.
+    // Returns false if frame is out of range.
+    bool PlayTo(APC40Interface& apc40, uint32_t frame)
+    {
+        if (!m_Header || frame >= m_Header->num_frames)
+            return false;
+
+        if (frame == m_Frame)
+            return true;
+
+        if (m_Frame == APC40_CLIP_NO_FRAME || frame < m_Frame || frame - m_Frame > m_Header->keyframe_interval)
+            return Seek(apc40, frame);
+
+        for (uint32_t f = m_Frame + 1; f <= frame; ++f)
+            ApplyFrame(apc40, f);
+
+        m_Frame = frame;
+
+        return true;
+    }
+
+    // Sets the complete state of a frame: the nearest snapshot before it plus the deltas up to it.
+    bool Seek(APC40Interface& apc40, uint32_t frame)
+    {
+        if (!m_Header || frame >= m_Header->num_frames)
+            return false;
+
+        uint32_t snapshot{ frame / m_Header->keyframe_interval };
+        const unsigned char* state{ GetData() + m_Header->snapshot_offset + static_cast<size_t>(snapshot) * APC40_NUM_CONTROLS };
+
+        for (size_t i = 0; i < APC40_NUM_CONTROLS; ++i)
+            apc40.SetControlValue(static_cast<eAPC40Control>(i), state[i]);
+
+        for (uint32_t f = snapshot * m_Header->keyframe_interval + 1; f <= frame; ++f)
+            ApplyFrame(apc40, f);
+
+        m_Frame = frame;
+
+        return true;
+    }
+
+    // Frame the interface was last brought to, APC40_CLIP_NO_FRAME if none.
+    uint32_t GetFrame() const
+    {
+        return m_Frame;
+    }
+
+    // Forgets the last frame, the next PlayTo seeks.
+    void Reset()
+    {
+        m_Frame = APC40_CLIP_NO_FRAME;
+    }
+
+    // ------------------------------------------------------------ Raw Access
+
+    // The deltas of a frame against the previous one, pointing into the mapping.
+    const APC40ClipDelta* GetFrameDeltas(uint32_t frame, size_t& count) const
+    {
+        count = 0;
+
+        if (!m_Header || frame >= m_Header->num_frames)
+            return nullptr;
+
+        const uint32_t* index{ GetIndex(m_Header->delta_index_offset) };
+
+        count = index[frame + 1] - index[frame];
+
+        return reinterpret_cast<const APC40ClipDelta*>(GetData() + m_Header->delta_offset) + index[frame];
+    }
+
+    // Returns the changes of a frame as midi messages, pointing into the mapping, and records them on the interface
+    // as sent (see APC40Interface::MarkControlSent). The bytes must be sent right away.
+    // Only valid if the device shows the previous frame, ie. when playing the clip from start to end.
+    const unsigned char* PrepareFrameMidi(APC40Interface& apc40, uint32_t frame, size_t& size)
+    {
+        const unsigned char* midi{ GetFrameMidi(frame, size) };
+
+        if (!midi)
+            return nullptr;
+
+        size_t count;
+        const APC40ClipDelta* deltas{ GetFrameDeltas(frame, count) };
+
+        for (size_t n = 0; n < count; ++n)
+            apc40.MarkControlSent(static_cast<eAPC40Control>(deltas[n].control), deltas[n].value);
+
+        m_Frame = frame;
+
+        return midi;
+    }
+
+    // The changes of a frame as midi messages, pointing into the mapping.
+    // Sending these directly leaves the interface's current state stale, use PrepareFrameMidi if the device is also driven by an interface.
+    const unsigned char* GetFrameMidi(uint32_t frame, size_t& size) const
+    {
+        size = 0;
+
+        if (!m_Header || frame >= m_Header->num_frames)
+            return nullptr;
+
+        const uint32_t* index{ GetIndex(m_Header->midi_index_offset) };
+
+        size = index[frame + 1] - index[frame];
+
+        return GetData() + m_Header->midi_offset + index[frame];
+    }
+
+private:
+
+    void ApplyFrame(APC40Interface& apc40, uint32_t frame)
+    {
+        size_t count;
+        const APC40ClipDelta* deltas{ GetFrameDeltas(frame, count) };
+
+        for (size_t n = 0; n < count; ++n)
+            apc40.SetControlValue(static_cast<eAPC40Control>(deltas[n].control), deltas[n].value);
+    }
+
+    const unsigned char* GetData() const
+    {
+        return static_cast<const unsigned char*>(m_File.GetData());
+    }
+
+    const uint32_t* GetIndex(uint32_t offset) const
+    {
+        return reinterpret_cast<const uint32_t*>(GetData() + offset);
+    }
+
+    // Checks the header and that all sections and indices stay within the file.
+    bool Validate()
+    {
+        size_t file_size{ m_File.GetSize() };
+
+        if (file_size < sizeof(APC40ClipHeader))
+            return false;
+
+        const APC40ClipHeader* header{ reinterpret_cast<const APC40ClipHeader*>(GetData()) };
+
+        if (header->magic != APC40_CLIP_MAGIC || header->version != APC40_CLIP_VERSION || header->num_controls != APC40_NUM_CONTROLS ||
+            header->num_frames == 0 || header->keyframe_interval == 0 || header->file_size > file_size)
+        {
+            return false;
+        }
+
+        size_t num_snapshots{ (static_cast<size_t>(header->num_frames) + header->keyframe_interval - 1) / header->keyframe_interval };
+        size_t index_size{ (static_cast<size_t>(header->num_frames) + 1) * sizeof(uint32_t) };
+
+        if (header->num_snapshots != num_snapshots ||
+            header->delta_index_offset % sizeof(uint32_t) != 0 || header->delta_index_offset + index_size > header->file_size ||
+            header->midi_index_offset % sizeof(uint32_t) != 0 || header->midi_index_offset + index_size > header->file_size ||
+            header->snapshot_offset + num_snapshots * APC40_NUM_CONTROLS > header->file_size)
+        {
+            return false;
+        }
+
+        const uint32_t* delta_index{ GetIndex(header->delta_index_offset) };
+        const uint32_t* midi_index{ GetIndex(header->midi_index_offset) };
+
+        for (uint32_t f = 0; f < header->num_frames; ++f)
+        {
+            if (delta_index[f] > delta_index[f + 1] || midi_index[f] > midi_index[f + 1])
+                return false;
+        }
+
+        if (header->delta_offset + static_cast<size_t>(delta_index[header->num_frames]) * sizeof(APC40ClipDelta) > header->file_size ||
+            header->midi_offset + static_cast<size_t>(midi_index[header->num_frames]) > header->file_size)
+        {
+            return false;
+        }
+
+        m_Header = header;
+
+        return true;
+    }
+
+    APC40MappedFile m_File;
+    const APC40ClipHeader* m_Header{ nullptr };
+    uint32_t m_Frame{ APC40_CLIP_NO_FRAME };
+};
+
+// ------------------------------------------------------------
+
+// Bakes frames into a clip file. Meant for offline use, it allocates as the clip grows.
+class APC40ClipRecorder
+{
+public:
+
+    APC40ClipRecorder()
+    {
+        Begin(16667, 60);
+    }
+
+    ~APC40ClipRecorder()
+    {
+
+    }
+
+    // Starts a new clip. All controls start as the device is after the init message (see APC40_INIT_STATE),
+    // so the first frame only contains what differs from it.
+    void Begin(uint32_t frame_duration, uint32_t keyframe_interval)
+    {
+        m_FrameDuration = frame_duration;
+        m_KeyframeInterval = std::max<uint32_t>(keyframe_interval, 1);
+
+        memcpy(m_State, APC40_INIT_STATE.data(), sizeof(m_State));
+        memcpy(m_Previous, APC40_INIT_STATE.data(), sizeof(m_Previous));
+
+        m_DeltaIndex.assign(1, 0);
+        m_MidiIndex.assign(1, 0);
+        m_Snapshots.clear();
+        m_Deltas.clear();
+        m_Midi.clear();
+    }
+
+    // Sets a control in the frame being recorded.
+    bool SetControlValue(eAPC40Control control, int value)
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return false;
+
+        m_State[static_cast<size_t>(control)] = static_cast<unsigned char>(std::clamp(value, 0, 127));
+
+        return true;
+    }
+
+    // Takes all controls of the frame being recorded from an interface's desired state.
+    void CaptureState(APC40Interface& apc40)
+    {
+        for (size_t i = 0; i < APC40_NUM_CONTROLS; ++i)
+        {
+            int value{ 0 };
+
+            apc40.GetControlValue(static_cast<eAPC40Control>(i), value);
+
+            m_State[i] = static_cast<unsigned char>(value);
+        }
+    }
+
+    // Finishes the frame being recorded. The next frame starts with the same values.
+    void EndFrame()
+    {
+        size_t frame{ m_DeltaIndex.size() - 1 };
+
+        for (size_t i = 0; i < APC40_NUM_CONTROLS; ++i)
+        {
+            if (m_State[i] == m_Previous[i])
+                continue;
+
+            m_Deltas.push_back({ static_cast<unsigned char>(i), m_State[i] });
+
+            unsigned char message[3];
+
+            if (APC40TranslateOutputMessage(static_cast<eAPC40Control>(i), m_State[i], message[0], message[1], message[2]))
+                m_Midi.insert(m_Midi.end(), message, message + 3);
+        }
+
+        if (frame % m_KeyframeInterval == 0)
+            m_Snapshots.insert(m_Snapshots.end(), m_State, m_State + APC40_NUM_CONTROLS);
+
+        m_DeltaIndex.push_back(static_cast<uint32_t>(m_Deltas.size()));
+        m_MidiIndex.push_back(static_cast<uint32_t>(m_Midi.size()));
+
+        memcpy(m_Previous, m_State, sizeof(m_State));
+    }
+
+    uint32_t GetNumFrames() const
+    {
+        return static_cast<uint32_t>(m_DeltaIndex.size() - 1);
+    }
+
+    bool Save(const char* path) const
+    {
+        uint32_t num_frames{ GetNumFrames() };
+
+        if (num_frames == 0)
+            return false;
+
+        APC40ClipHeader header{};
+
+        header.magic = APC40_CLIP_MAGIC;
+        header.version = APC40_CLIP_VERSION;
+        header.num_controls = static_cast<uint32_t>(APC40_NUM_CONTROLS);
+        header.num_frames = num_frames;
+        header.frame_duration = m_FrameDuration;
+        header.keyframe_interval = m_KeyframeInterval;
+        header.num_snapshots = static_cast<uint32_t>(m_Snapshots.size() / APC40_NUM_CONTROLS);
+
+        size_t index_size{ m_DeltaIndex.size() * sizeof(uint32_t) };
+
+        header.delta_index_offset = static_cast<uint32_t>(sizeof(APC40ClipHeader));
+        header.midi_index_offset = static_cast<uint32_t>(header.delta_index_offset + index_size);
+        header.snapshot_offset = static_cast<uint32_t>(header.midi_index_offset + index_size);
+        header.delta_offset = static_cast<uint32_t>(header.snapshot_offset + m_Snapshots.size());
+        header.midi_offset = static_cast<uint32_t>(header.delta_offset + m_Deltas.size() * sizeof(APC40ClipDelta));
+        header.file_size = static_cast<uint32_t>(header.midi_offset + m_Midi.size());
+
+        APC40MappedFile file;
+
+        if (!file.Open(path, header.file_size, true))
+            return false;
+
+        unsigned char* data{ static_cast<unsigned char*>(file.GetData()) };
+
+        memcpy(data, &header, sizeof(header));
+        memcpy(data + header.delta_index_offset, m_DeltaIndex.data(), index_size);
+        memcpy(data + header.midi_index_offset, m_MidiIndex.data(), index_size);
+        memcpy(data + header.snapshot_offset, m_Snapshots.data(), m_Snapshots.size());
+
+        if (!m_Deltas.empty())
+            memcpy(data + header.delta_offset, m_Deltas.data(), m_Deltas.size() * sizeof(APC40ClipDelta));
+
+        if (!m_Midi.empty())
+            memcpy(data + header.midi_offset, m_Midi.data(), m_Midi.size());
+
+        return file.Sync();
+    }
+
+private:
+
+    uint32_t m_FrameDuration{ 0 };
+    uint32_t m_KeyframeInterval{ 1 };
+
+    unsigned char m_State[APC40_NUM_CONTROLS];
+    unsigned char m_Previous[APC40_NUM_CONTROLS];
+
+    std::vector<uint32_t> m_DeltaIndex;
+    std::vector<uint32_t> m_MidiIndex;
+    std::vector<unsigned char> m_Snapshots;
+    std::vector<APC40ClipDelta> m_Deltas;
+    std::vector<unsigned char> m_Midi;
+};
+
+// ------------------------------------------------------------ EOF
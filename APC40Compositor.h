@@ -0,0 +1,318 @@
+#pragma once
+
+#include "APC40Interface.h"
+
+// ------------------------------------------------------------
+/*
+
+Layer compositor for modules that draw on the same device independently (clip grid, meter overlay, notifications, ...).
+
+Every layer owns a full set of control values plus a coverage mask of the controls it actually draws.
+Each control shows the value of the topmost visible layer covering it, or 0 if no layer does.
+
+Layers track which controls they changed. Compose only resolves those controls and sets the ones whose
+result changed on the interface, so showing or hiding an overlay costs work proportional to its area.
+
+Usage:
+
+APC40Compositor compositor;
+
+APC40Layer* clips = compositor.AddLayer(0);
+APC40Layer* overlay = compositor.AddLayer(10);
+
+clips->SetControlMode(APC40PackControl(eAPC40Control::Pad, 0, 0), eAPC40LEDMode::Green);
+overlay->Fill(APC40PadRowMask(0), static_cast<unsigned char>(eAPC40LEDMode::Red));
+overlay->SetVisible(false);
+
+compositor.Compose(apc40);
+
+*/
+// ------------------------------------------------------------
+
+constexpr size_t APC40_MAX_LAYERS = 16;
+
+class APC40Layer
+{
+public:
+
+    APC40Layer()
+    {
+
+    }
+
+    ~APC40Layer()
+    {
+
+    }
+
+    // ------------------------------------------------------------ Drawing
+
+    bool SetControlMode(eAPC40Control control, eAPC40LEDMode mode)
+    {
+        return SetControlValue(control, static_cast<int>(mode));
+    }
+
+    bool SetControlMode(eAPC40Control control, eAPC40KnobMode mode)
+    {
+        return SetControlValue(control, static_cast<int>(mode));
+    }
+
+    // Sets a value and adds the control to the coverage.
+    bool SetControlValue(eAPC40Control control, int value)
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return false;
+
+        size_t i{ static_cast<size_t>(control) };
+        unsigned char clamped{ static_cast<unsigned char>(std::clamp(value, 0, 127)) };
+
+        if (m_Coverage.Test(i) && m_Values[i] == clamped)
+            return true;
+
+        m_Values[i] = clamped;
+        m_Coverage.Set(i);
+        m_Dirty.Set(i);
+
+        return true;
+    }
+
+    // Sets all controls in mask to value and adds them to the coverage.
+    void Fill(const APC40ControlMask& mask, unsigned char value)
+    {
+        APC40ControlMask controls{ mask & ~APC40ControlMaskFrom(APC40_NUM_CONTROLS) };
+        unsigned char clamped{ std::min<unsigned char>(value, 127) };
+
+        controls.ForEach([&](size_t i) { m_Values[i] = clamped; });
+
+        m_Coverage |= controls;
+        m_Dirty |= controls;
+    }
+
+    // Removes a control from the coverage, the layers below show through.
+    bool ClearControl(eAPC40Control control)
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return false;
+
+        Clear(APC40ControlMaskFrom(static_cast<size_t>(control)) & ~APC40ControlMaskFrom(static_cast<size_t>(control) + 1));
+
+        return true;
+    }
+
+    // Removes all controls in mask from the coverage.
+    void Clear(const APC40ControlMask& mask)
+    {
+        m_Dirty |= m_Coverage & mask;
+        m_Coverage &= ~mask;
+    }
+
+    void Clear()
+    {
+        m_Dirty |= m_Coverage;
+        m_Coverage.Clear();
+    }
+
+    // ------------------------------------------------------------ Properties
+
+    // Hidden layers keep their content.
+    void SetVisible(bool visible)
+    {
+        if (visible == m_Visible)
+            return;
+
+        m_Visible = visible;
+        m_Dirty |= m_Coverage;
+    }
+
+    bool IsVisible() const
+    {
+        return m_Visible;
+    }
+
+    int GetZ() const
+    {
+        return m_Z;
+    }
+
+    const APC40ControlMask& GetCoverage() const
+    {
+        return m_Coverage;
+    }
+
+    int GetControlValue(eAPC40Control control) const
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return 0;
+
+        return m_Values[static_cast<size_t>(control)];
+    }
+
+private:
+
+    friend class APC40Compositor;
+
+    unsigned char m_Values[APC40_NUM_CONTROLS]{};
+    APC40ControlMask m_Coverage;
+
+    // Controls whose contribution changed since the last Compose.
+    APC40ControlMask m_Dirty;
+
+    int m_Z{ 0 };
+    bool m_Visible{ true };
+    bool m_Used{ false };
+};
+
+// ------------------------------------------------------------
+
+class APC40Compositor
+{
+public:
+
+    APC40Compositor()
+    {
+        memset(m_Output, 255, sizeof(m_Output));
+    }
+
+    ~APC40Compositor()
+    {
+
+    }
+
+    APC40Compositor(const APC40Compositor&) = delete;
+    APC40Compositor& operator=(const APC40Compositor&) = delete;
+
+    // Adds an empty layer. Higher z is drawn on top, a new layer goes on top of existing layers with the same z.
+    // Returns nullptr if all APC40_MAX_LAYERS layers are in use.
+    APC40Layer* AddLayer(int z)
+    {
+        for (APC40Layer& layer : m_Layers)
+        {
+            if (layer.m_Used)
+                continue;
+
+            layer = APC40Layer{};
+            layer.m_Z = z;
+            layer.m_Used = true;
+
+            // Insert into the top to bottom order
+            size_t position{ 0 };
+
+            while (position < m_NumLayers && m_Order[position]->m_Z > z)
+                ++position;
+
+            for (size_t n = m_NumLayers; n > position; --n)
+                m_Order[n] = m_Order[n - 1];
+
+            m_Order[position] = &layer;
+            ++m_NumLayers;
+
+            return &layer;
+        }
+
+        return nullptr;
+    }
+
+    void RemoveLayer(APC40Layer* layer)
+    {
+        for (size_t position = 0; position < m_NumLayers; ++position)
+        {
+            if (m_Order[position] != layer)
+                continue;
+
+            // Controls the layer cleared since the last Compose are no longer covered, but still need to be resolved
+            m_Dirty |= layer->m_Coverage | layer->m_Dirty;
+            layer->m_Dirty.Clear();
+            layer->m_Used = false;
+
+            for (size_t n = position + 1; n < m_NumLayers; ++n)
+                m_Order[n - 1] = m_Order[n];
+
+            --m_NumLayers;
+
+            return;
+        }
+    }
+
+    // Makes the next Compose set every control the compositor has ever touched, ie. after the interface was changed elsewhere.
+    void Invalidate()
+    {
+        memset(m_Output, 255, sizeof(m_Output));
+        m_Dirty |= m_Written;
+    }
+
+    // Resolves the controls changed by any layer and sets the results that differ from the last Compose.
+    // Returns the number of controls set.
+    unsigned int Compose(APC40Interface& apc40)
+    {
+        APC40ControlMask remaining{ m_Dirty };
+
+        for (size_t position = 0; position < m_NumLayers; ++position)
+        {
+            remaining |= m_Order[position]->m_Dirty;
+            m_Order[position]->m_Dirty.Clear();
+        }
+
+        m_Dirty.Clear();
+
+        APC40ControlMask resolved{ remaining };
+
+        // Top to bottom, each layer claims the remaining controls it covers
+        for (size_t position = 0; position < m_NumLayers && remaining.Any(); ++position)
+        {
+            const APC40Layer& layer{ *m_Order[position] };
+
+            if (!layer.m_Visible)
+                continue;
+
+            APC40ControlMask claimed{ remaining & layer.m_Coverage };
+
+            claimed.ForEach([&](size_t i) { m_Composed[i] = layer.m_Values[i]; });
+
+            remaining &= ~claimed;
+        }
+
+        // Uncovered controls fall back to off
+        remaining.ForEach([&](size_t i) { m_Composed[i] = 0; });
+
+        return Flush(apc40, resolved);
+    }
+
+private:
+
+    // Sets the resolved controls whose result changed.
+    unsigned int Flush(APC40Interface& apc40, const APC40ControlMask& resolved)
+    {
+        APC40ControlMask changed{ APC40DiffStates(m_Composed, m_Output) & resolved };
+
+        unsigned int num_set{ 0 };
+
+        changed.ForEach([&](size_t i)
+        {
+            apc40.SetControlValue(static_cast<eAPC40Control>(i), m_Composed[i]);
+            m_Output[i] = m_Composed[i];
+            ++num_set;
+        });
+
+        m_Written |= changed;
+
+        return num_set;
+    }
+
+    APC40Layer m_Layers[APC40_MAX_LAYERS];
+
+    // Used layers, top to bottom.
+    APC40Layer* m_Order[APC40_MAX_LAYERS]{};
+    size_t m_NumLayers{ 0 };
+
+    // Controls uncovered by removed layers.
+    APC40ControlMask m_Dirty;
+
+    // Result of the last Compose and what was set on the interface (255 if unknown).
+    alignas(APC40_STATE_ALIGNMENT) unsigned char m_Composed[APC40_STATE_SIZE]{};
+    alignas(APC40_STATE_ALIGNMENT) unsigned char m_Output[APC40_STATE_SIZE];
+
+    // Controls the compositor has set at least once.
+    APC40ControlMask m_Written;
+};
+
+// ------------------------------------------------------------ EOF
@@ -0,0 +1,345 @@
+#pragma once
+
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "APC40Interface.h"
+
+// ------------------------------------------------------------
+/*
+
+Runs up to APC40_MAX_DEVICES APC40s from one place.
+
+The current and desired states of all devices live in two contiguous buffers (one state per
+APC40_STATE_SIZE slot), which the devices' interfaces are attached to. Update flushes every
+device into its own output buffer. A flush only diffs the controls that were set since the last
+one, so a device without changes costs a dirty mask check and is never diffed.
+
+The flushes can optionally be spread over a small thread pool. Input messages are routed to
+the device opened on the same midi port.
+
+Usage:
+
+APC40DeviceManager manager;
+
+int left = manager.AddDevice(left_port);
+int right = manager.AddDevice(right_port);
+
+manager.GetDevice(left)->SetControlMode(APC40PackControl(eAPC40Control::Pad, 0, 0), eAPC40LEDMode::Green);
+
+// Every frame
+uint32_t devices = manager.Update(true);
+
+for (int d = 0; d < APC40_MAX_DEVICES; ++d)
+{
+    size_t size;
+    const unsigned char* midi = manager.GetOutput(d, size);
+
+    if (size > 0)
+        YourSend(manager.GetPortId(d), midi, size);
+}
+
+// Input callback
+APC40Input input;
+int device = manager.TranslateInputMessage(port, midi_message, message_size, input);
+
+*/
+// ------------------------------------------------------------
+
+constexpr int APC40_MAX_DEVICES = 8;
+
+class APC40DeviceManager
+{
+public:
+
+    APC40DeviceManager()
+    {
+        memset(m_CurrentStates, 0, sizeof(m_CurrentStates));
+        memset(m_DesiredStates, 0, sizeof(m_DesiredStates));
+
+        for (int& port_id : m_PortIds)
+            port_id = -1;
+    }
+
+    ~APC40DeviceManager()
+    {
+        SetNumThreads(0);
+    }
+
+    APC40DeviceManager(const APC40DeviceManager&) = delete;
+    APC40DeviceManager& operator=(const APC40DeviceManager&) = delete;
+
+    // ------------------------------------------------------------ Devices
+
+    // Adds a device for a midi port. Its state starts unknown, so the first Update redraws it completely.
+    // Returns the device index, or -1 if the port is in use or all devices are taken.
+    int AddDevice(int port_id)
+    {
+        if (port_id < 0 || FindDevice(port_id) >= 0)
+            return -1;
+
+        for (int d = 0; d < APC40_MAX_DEVICES; ++d)
+        {
+            if (m_Devices[d])
+                continue;
+
+            memset(m_DesiredStates[d], 0, APC40_STATE_SIZE);
+            memset(m_CurrentStates[d], 0, APC40_STATE_SIZE);
+            memset(m_CurrentStates[d], 255, APC40_NUM_CONTROLS);
+
+            m_Devices[d] = std::make_unique<APC40Interface>();
+            m_Devices[d]->AttachState(m_CurrentStates[d], m_DesiredStates[d]);
+
+            m_PortIds[d] = port_id;
+            m_OutputSizes[d] = 0;
+
+            return d;
+        }
+
+        return -1;
+    }
+
+    bool RemoveDevice(int index)
+    {
+        if (!IsValidDevice(index))
+            return false;
+
+        m_Devices[index].reset();
+        m_PortIds[index] = -1;
+        m_OutputSizes[index] = 0;
+
+        return true;
+    }
+
+    // Returns the index of the device on a midi port, or -1.
+    int FindDevice(int port_id) const
+    {
+        for (int d = 0; d < APC40_MAX_DEVICES; ++d)
+        {
+            if (m_Devices[d] && m_PortIds[d] == port_id)
+                return d;
+        }
+
+        return -1;
+    }
+
+    APC40Interface* GetDevice(int index) const
+    {
+        return IsValidDevice(index) ? m_Devices[index].get() : nullptr;
+    }
+
+    int GetPortId(int index) const
+    {
+        return IsValidDevice(index) ? m_PortIds[index] : -1;
+    }
+
+    bool IsValidDevice(int index) const
+    {
+        return index >= 0 && index < APC40_MAX_DEVICES && m_Devices[index];
+    }
+
+    // ------------------------------------------------------------ Output
+
+    // Number of worker threads that flush devices alongside the calling thread. 0 (the default) flushes on the calling thread only.
+    // Only worth it if many devices change every frame, a single flush takes about a microsecond.
+    void SetNumThreads(unsigned int num_threads)
+    {
+        if (!m_Threads.empty())
+        {
+            {
+                std::lock_guard<std::mutex> lock{ m_Mutex };
+                m_Stop = true;
+            }
+
+            m_WakeUp.notify_all();
+
+            for (std::thread& thread : m_Threads)
+                thread.join();
+
+            m_Threads.clear();
+            m_Stop = false;
+        }
+
+        for (unsigned int n = 0; n < num_threads; ++n)
+            m_Threads.emplace_back([this]() { WorkerLoop(); });
+    }
+
+    unsigned int GetNumThreads() const
+    {
+        return static_cast<unsigned int>(m_Threads.size());
+    }
+
+    // Generates the midi messages of all devices and marks them as sent.
+    // Returns one bit per device that has output, see GetOutput.
+    uint32_t Update(bool running_status)
+    {
+        int jobs[APC40_MAX_DEVICES];
+        unsigned int num_jobs{ 0 };
+
+        // The flush itself skips devices without dirty controls, so there is no separate diff up front
+        for (int d = 0; d < APC40_MAX_DEVICES; ++d)
+        {
+            m_OutputSizes[d] = 0;
+
+            if (m_Devices[d])
+                jobs[num_jobs++] = d;
+        }
+
+        if (num_jobs > 1 && !m_Threads.empty())
+            RunJobs(jobs, num_jobs, running_status);
+        else
+        {
+            for (unsigned int n = 0; n < num_jobs; ++n)
+                FlushDevice(jobs[n], running_status);
+        }
+
+        uint32_t devices{ 0 };
+
+        for (int d = 0; d < APC40_MAX_DEVICES; ++d)
+        {
+            if (m_OutputSizes[d] > 0)
+                devices |= 1u << d;
+        }
+
+        return devices;
+    }
+
+    // The messages generated for a device by the last Update.
+    const unsigned char* GetOutput(int index, size_t& size) const
+    {
+        if (index < 0 || index >= APC40_MAX_DEVICES)
+        {
+            size = 0;
+            return nullptr;
+        }
+
+        size = m_OutputSizes[index];
+
+        return m_Outputs[index].data();
+    }
+
+    // ------------------------------------------------------------ Input
+
+    // Translates an input message of the device on a midi port. Returns the device index, or -1 if no device is on the port or the message isn't valid.
+    int TranslateInputMessage(int port_id, const unsigned char* midi_message, unsigned int midi_message_size, APC40Input& input_message)
+    {
+        int d{ FindDevice(port_id) };
+
+        if (d < 0 || !m_Devices[d]->TranslateInputMessage(midi_message, midi_message_size, input_message))
+            return -1;
+
+        return d;
+    }
+
+    int TranslateInputMessage(int port_id, unsigned int midi_message, APC40Input& input_message)
+    {
+        int d{ FindDevice(port_id) };
+
+        if (d < 0 || !m_Devices[d]->TranslateInputMessage(midi_message, input_message))
+            return -1;
+
+        return d;
+    }
+
+private:
+
+    void FlushDevice(int d, bool running_status)
+    {
+        m_OutputSizes[d] = m_Devices[d]->GetMidiMessages(m_Outputs[d], true, running_status);
+    }
+
+    // Claims and flushes jobs until none are left.
+    void FlushJobs()
+    {
+        for (;;)
+        {
+            unsigned int n{ m_NextJob.fetch_add(1, std::memory_order_relaxed) };
+
+            if (n >= m_NumJobs)
+                return;
+
+            FlushDevice(m_Jobs[n], m_RunningStatus);
+        }
+    }
+
+    // Flushes the jobs on the workers and the calling thread, returns once all are done.
+    void RunJobs(const int* jobs, unsigned int num_jobs, bool running_status)
+    {
+        {
+            std::unique_lock<std::mutex> lock{ m_Mutex };
+
+            // Workers woken late by the previous run may still be looking for jobs
+            m_Done.wait(lock, [this]() { return m_NumActive == 0; });
+
+            memcpy(m_Jobs, jobs, num_jobs * sizeof(int));
+            m_NumJobs = num_jobs;
+            m_RunningStatus = running_status;
+            m_NextJob.store(0, std::memory_order_relaxed);
+            ++m_Generation;
+        }
+
+        m_WakeUp.notify_all();
+
+        FlushJobs();
+
+        std::unique_lock<std::mutex> lock{ m_Mutex };
+        m_Done.wait(lock, [this]() { return m_NumActive == 0; });
+    }
+
+    void WorkerLoop()
+    {
+        uint64_t generation{ 0 };
+
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock{ m_Mutex };
+                m_WakeUp.wait(lock, [&]() { return m_Stop || m_Generation != generation; });
+
+                if (m_Stop)
+                    return;
+
+                generation = m_Generation;
+                ++m_NumActive;
+            }
+
+            FlushJobs();
+
+            {
+                std::lock_guard<std::mutex> lock{ m_Mutex };
+                --m_NumActive;
+            }
+
+            m_Done.notify_all();
+        }
+    }
+
+    // States of all devices, device d uses slot d.
+    alignas(APC40_STATE_ALIGNMENT) unsigned char m_CurrentStates[APC40_MAX_DEVICES][APC40_STATE_SIZE];
+    alignas(APC40_STATE_ALIGNMENT) unsigned char m_DesiredStates[APC40_MAX_DEVICES][APC40_STATE_SIZE];
+
+    std::unique_ptr<APC40Interface> m_Devices[APC40_MAX_DEVICES];
+    int m_PortIds[APC40_MAX_DEVICES];
+
+    APC40MidiBuffer m_Outputs[APC40_MAX_DEVICES];
+    size_t m_OutputSizes[APC40_MAX_DEVICES]{};
+
+    // Devices to flush in the current Update, only changed while no worker is active.
+    int m_Jobs[APC40_MAX_DEVICES]{};
+    unsigned int m_NumJobs{ 0 };
+    bool m_RunningStatus{ false };
+    std::atomic<unsigned int> m_NextJob{ 0 };
+
+    // Thread pool
+    std::vector<std::thread> m_Threads;
+    std::mutex m_Mutex;
+    std::condition_variable m_WakeUp;
+    std::condition_variable m_Done;
+    uint64_t m_Generation{ 0 };
+    unsigned int m_NumActive{ 0 };
+    bool m_Stop{ false };
+};
+
+// ------------------------------------------------------------ EOF
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "APC40Interface.h"
+
+// ------------------------------------------------------------
+/*
+
+Dispatches input messages to handlers, instead of switch chains on APC40StripControl.
+
+Handlers are registered for a single control, a whole control group (ie. eAPC40Control::Pad or
+eAPC40Control::TrackKnobValue) or a pad rectangle. Compile flattens them into one table indexed
+by control, so dispatching is a table lookup and an indirect call per handler.
+
+Every handler belongs to one of APC40_MAX_HANDLER_GROUPS groups, which can be enabled and
+disabled without recompiling, ie. when switching between app modes.
+
+Usage:
+
+APC40Dispatcher dispatcher;
+
+dispatcher.Register(eAPC40Control::Play, &OnPlay, &app);
+dispatcher.RegisterPadRect(0, 0, 8, 5, &OnClip, &app, CLIP_MODE_GROUP);
+dispatcher.Compile();
+
+// Input callback
+APC40Input input;
+
+if (apc40.TranslateInputMessage(midi_message, message_size, input))
+    dispatcher.Dispatch(input);
+
+*/
+// ------------------------------------------------------------
+
+using APC40InputHandler = void (*)(const APC40Input& input, void* user_data);
+
+constexpr unsigned int APC40_MAX_HANDLER_GROUPS = 64;
+
+// ------------------------------------------------------------
+
+class APC40Dispatcher
+{
+public:
+
+    APC40Dispatcher()
+    {
+        memset(m_Offsets, 0, sizeof(m_Offsets));
+    }
+
+    ~APC40Dispatcher()
+    {
+
+    }
+
+    // ------------------------------------------------------------ Registration
+
+    // Registrations take effect after the next Compile. Handlers of a control are called in registration order.
+
+    bool Register(eAPC40Control control, APC40InputHandler handler, void* user_data = nullptr, unsigned int group = 0)
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return false;
+
+        APC40ControlMask mask{};
+        mask.Set(static_cast<size_t>(control));
+
+        return RegisterMask(mask, handler, user_data, group);
+    }
+
+    // control is a stripped control, ie. eAPC40Control::VolumeSlider registers all sliders.
+    bool RegisterGroup(eAPC40Control control, APC40InputHandler handler, void* user_data = nullptr, unsigned int group = 0)
+    {
+        return RegisterMask(APC40ControlGroupMask(control), handler, user_data, group);
+    }
+
+    // Pads outside of the pad are ignored.
+    bool RegisterPadRect(int x, int y, int width, int height, APC40InputHandler handler, void* user_data = nullptr, unsigned int group = 0)
+    {
+        return RegisterMask(APC40PadRectMask(x, y, width, height), handler, user_data, group);
+    }
+
+    bool RegisterMask(const APC40ControlMask& mask, APC40InputHandler handler, void* user_data = nullptr, unsigned int group = 0)
+    {
+        APC40ControlMask controls{ mask & ~APC40ControlMaskFrom(APC40_NUM_CONTROLS) };
+
+        if (!handler || group >= APC40_MAX_HANDLER_GROUPS || !controls.Any())
+            return false;
+
+        m_Registrations.push_back({ controls, handler, user_data, group });
+
+        return true;
+    }
+
+    // Removes all registrations. The compiled table stays in use until the next Compile.
+    void Clear()
+    {
+        m_Registrations.clear();
+    }
+
+    // Builds the dispatch table. This is the only place that allocates.
+    void Compile()
+    {
+        unsigned int counts[APC40_NUM_CONTROLS]{};
+
+        for (const Registration& registration : m_Registrations)
+            registration.mask.ForEach([&](size_t i) { ++counts[i]; });
+
+        m_Offsets[0] = 0;
+
+        for (size_t i = 0; i < APC40_NUM_CONTROLS; ++i)
+            m_Offsets[i + 1] = m_Offsets[i] + counts[i];
+
+        m_Entries.resize(m_Offsets[APC40_NUM_CONTROLS]);
+
+        unsigned int cursors[APC40_NUM_CONTROLS];
+        memcpy(cursors, m_Offsets, sizeof(cursors));
+
+        for (const Registration& registration : m_Registrations)
+        {
+            registration.mask.ForEach([&](size_t i)
+            {
+                m_Entries[cursors[i]++] = { registration.handler, registration.user_data, uint64_t{ 1 } << registration.group };
+            });
+        }
+    }
+
+    // ------------------------------------------------------------ Groups
+
+    void SetGroupEnabled(unsigned int group, bool enabled)
+    {
+        if (group >= APC40_MAX_HANDLER_GROUPS)
+            return;
+
+        if (enabled)
+            m_EnabledGroups |= uint64_t{ 1 } << group;
+        else
+            m_EnabledGroups &= ~(uint64_t{ 1 } << group);
+    }
+
+    bool IsGroupEnabled(unsigned int group) const
+    {
+        return group < APC40_MAX_HANDLER_GROUPS && ((m_EnabledGroups >> group) & 1);
+    }
+
+    // One bit per group, all groups are enabled by default.
+    void SetEnabledGroups(uint64_t groups)
+    {
+        m_EnabledGroups = groups;
+    }
+
+    uint64_t GetEnabledGroups() const
+    {
+        return m_EnabledGroups;
+    }
+
+    // ------------------------------------------------------------ Dispatch
+
+    // Calls the enabled handlers of the input's control. Returns the number of handlers called.
+    unsigned int Dispatch(const APC40Input& input) const
+    {
+        if (input.control < eAPC40Control::MinValue || input.control >= eAPC40Control::MaxValue)
+            return 0;
+
+        size_t i{ static_cast<size_t>(input.control) };
+        unsigned int num_called{ 0 };
+
+        for (unsigned int n = m_Offsets[i]; n < m_Offsets[i + 1]; ++n)
+        {
+            const Entry& entry{ m_Entries[n] };
+
+            if (entry.group_bit & m_EnabledGroups)
+            {
+                entry.handler(input, entry.user_data);
+                ++num_called;
+            }
+        }
+
+        return num_called;
+    }
+
+private:
+
+    struct Registration
+    {
+        APC40ControlMask mask;
+        APC40InputHandler handler;
+        void* user_data;
+        unsigned int group;
+    };
+
+    struct Entry
+    {
+        APC40InputHandler handler = nullptr;
+        void* user_data = nullptr;
+        uint64_t group_bit = 0;
+    };
+
+    std::vector<Registration> m_Registrations;
+
+    // Handlers of control i are m_Entries[m_Offsets[i]] to m_Entries[m_Offsets[i + 1] - 1].
+    unsigned int m_Offsets[APC40_NUM_CONTROLS + 1];
+    std::vector<Entry> m_Entries;
+
+    uint64_t m_EnabledGroups{ ~uint64_t{ 0 } };
+};
+
+// ------------------------------------------------------------ EOF
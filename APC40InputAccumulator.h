@@ -0,0 +1,174 @@
+#pragma once
+
+#include "APC40Interface.h"
+
+// ------------------------------------------------------------
+/*
+
+Coalesces input messages per frame.
+
+Sliders and knobs send bursts of messages, but usually only the latest value per frame matters.
+The accumulator keeps the last value of every absolute control (volume/crossfade sliders, track and device knobs)
+and the summed delta of the relative cue level knob. Button and pad edges are kept in their original order.
+
+Usage:
+
+// Input callback
+APC40Input input;
+
+if (apc40.TranslateInputMessage(midi_message, message_size, input))
+    accumulator.Add(input);
+
+// Once per frame
+accumulator.Drain([](const APC40Input& input) { ... });
+
+*/
+// ------------------------------------------------------------
+
+// Maximum number of button/pad edges per frame, further edges are dropped.
+constexpr size_t APC40_MAX_ACCUMULATED_EDGES = 256;
+
+// Decodes the value of a relative control (ie. CueLevelKnob) into a signed delta.
+constexpr int APC40DecodeRelativeValue(int value)
+{
+    return value < 64 ? value : value - 128;
+}
+
+// Encodes a signed delta into the value of a relative control, clamped to -64 - 63.
+constexpr int APC40EncodeRelativeValue(int delta)
+{
+    return delta < 0 ? 128 + (delta < -64 ? -64 : delta) : (delta > 63 ? 63 : delta);
+}
+
+constexpr APC40ControlMask APC40BuildAbsoluteInputMask()
+{
+    APC40ControlMask mask{};
+
+    for (size_t i = static_cast<size_t>(eAPC40Control::VolumeSlider); i <= static_cast<size_t>(eAPC40Control::CrossfadeSlider); ++i)
+        mask.Set(i);
+
+    for (int i = 0; i < APC40_NUM_KNOBS; ++i)
+    {
+        mask.Set(static_cast<size_t>(APC40PackControl(eAPC40Control::TrackKnobValue, i)));
+        mask.Set(static_cast<size_t>(APC40PackControl(eAPC40Control::DeviceKnobValue, i)));
+    }
+
+    return mask;
+}
+
+// Input controls that send absolute values (sliders and knobs).
+constexpr APC40ControlMask APC40_ABSOLUTE_INPUT_MASK{ APC40BuildAbsoluteInputMask() };
+
+// ------------------------------------------------------------
+
+class APC40InputAccumulator
+{
+public:
+
+    APC40InputAccumulator()
+    {
+
+    }
+
+    ~APC40InputAccumulator()
+    {
+
+    }
+
+    // Adds an input message. Returns false if it was an edge and the edge queue is full.
+    bool Add(const APC40Input& input)
+    {
+        if (input.control < eAPC40Control::MinValue || input.control >= eAPC40Control::MaxValue)
+            return false;
+
+        size_t i{ static_cast<size_t>(input.control) };
+
+        if (APC40_ABSOLUTE_INPUT_MASK.Test(i))
+        {
+            m_Values[i] = input.value;
+            m_Pending.Set(i);
+
+            return true;
+        }
+
+        if (input.control == eAPC40Control::CueLevelKnob)
+        {
+            m_Values[i] += APC40DecodeRelativeValue(input.value);
+            m_Pending.Set(i);
+
+            return true;
+        }
+
+        if (m_NumEdges >= APC40_MAX_ACCUMULATED_EDGES)
+            return false;
+
+        m_Edges[m_NumEdges++] = input;
+
+        return true;
+    }
+
+    // Calls func(const APC40Input&) for every button/pad edge in the order they were added,
+    // then once for every slider/knob that changed, and clears the accumulator.
+    // Absolute controls report their last value, the cue level knob reports its summed delta (encoded like the device does).
+    // A cue level delta beyond -64 - 63 is reported up to the limit, the remainder stays pending for the next Drain.
+    template <typename Func>
+    void Drain(Func&& func)
+    {
+        for (size_t n = 0; n < m_NumEdges; ++n)
+            func(m_Edges[n]);
+
+        APC40ControlMask pending{ m_Pending };
+
+        m_NumEdges = 0;
+        m_Pending.Clear();
+
+        pending.ForEach([&](size_t i)
+        {
+            APC40Input input;
+
+            input.control = static_cast<eAPC40Control>(i);
+            input.pressed = true;
+
+            if (input.control == eAPC40Control::CueLevelKnob)
+            {
+                if (m_Values[i] == 0)
+                    return;
+
+                input.value = APC40EncodeRelativeValue(m_Values[i]);
+                m_Values[i] -= APC40DecodeRelativeValue(input.value);
+
+                if (m_Values[i] != 0)
+                    m_Pending.Set(i);
+            }
+            else
+            {
+                input.value = m_Values[i];
+            }
+
+            func(input);
+        });
+    }
+
+    void Clear()
+    {
+        m_NumEdges = 0;
+        m_Pending.Clear();
+        m_Values[static_cast<size_t>(eAPC40Control::CueLevelKnob)] = 0;
+    }
+
+    bool IsEmpty() const
+    {
+        return m_NumEdges == 0 && !m_Pending.Any();
+    }
+
+private:
+
+    // Last value of absolute controls, summed delta of the cue level knob
+    int m_Values[APC40_NUM_CONTROLS]{};
+    APC40ControlMask m_Pending;
+
+    APC40Input m_Edges[APC40_MAX_ACCUMULATED_EDGES];
+    size_t m_NumEdges{ 0 };
+};
+
+// ------------------------------------------------------------ EOF
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <atomic>
+
+#include "APC40Interface.h"
+
+#if defined __linux__
+#include <unistd.h>
+#include <sys/eventfd.h>
+#endif
+
+// ------------------------------------------------------------
+/*
+
+Lock-free single producer / single consumer queue for input events.
+
+Midi libraries usually call back on their own thread. The callback pushes translated input into
+the queue (wait-free, never blocks or allocates) and the app thread drains it in batches.
+
+On Linux, an eventfd can be enabled to wake up epoll/poll driven consumers.
+
+Usage:
+
+APC40InputQueue<> queue;
+
+// Midi callback thread
+APC40Input input;
+
+if (apc40.TranslateInputMessage(midi_message, message_size, input))
+    queue.Push(input);
+
+// App thread
+queue.Drain([](const APC40InputEvent& event) { ... });
+
+*/
+// ------------------------------------------------------------
+
+constexpr size_t APC40_CACHE_LINE_SIZE = 64;
+
+// Compact (8 byte) version of APC40Input with a timestamp.
+struct APC40InputEvent
+{
+    uint32_t timestamp = 0;
+    unsigned char control = static_cast<unsigned char>(eAPC40Control::Invalid);
+    unsigned char value = 0;
+    bool pressed = false;
+
+    static APC40InputEvent FromInput(const APC40Input& input, uint32_t timestamp)
+    {
+        APC40InputEvent event;
+
+        event.timestamp = timestamp;
+        event.control = static_cast<unsigned char>(input.control);
+        event.value = static_cast<unsigned char>(input.value);
+        event.pressed = input.pressed;
+
+        return event;
+    }
+
+    APC40Input ToInput() const
+    {
+        APC40Input input;
+
+        input.control = static_cast<eAPC40Control>(control);
+        input.value = static_cast<int>(value);
+        input.pressed = pressed;
+
+        return input;
+    }
+};
+
+static_assert(sizeof(APC40InputEvent) == 8, "APC40InputEvent should stay compact");
+
+// ------------------------------------------------------------
+
+// Capacity must be a power of two.
+template <size_t Capacity = 1024>
+class APC40InputQueue
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+
+    APC40InputQueue()
+    {
+
+    }
+
+    ~APC40InputQueue()
+    {
+#if defined __linux__
+        if (m_EventFd >= 0)
+            close(m_EventFd);
+#endif
+    }
+
+    APC40InputQueue(const APC40InputQueue&) = delete;
+    APC40InputQueue& operator=(const APC40InputQueue&) = delete;
+
+    // Creates an eventfd that becomes readable when events are pushed into an empty queue (Linux only).
+    // Call this before producer and consumer start. Returns false if not supported.
+    bool EnableEventFd()
+    {
+#if defined __linux__
+        if (m_EventFd < 0)
+            m_EventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        return m_EventFd >= 0;
+#else
+        return false;
+#endif
+    }
+
+    // The eventfd to add to epoll/poll, or -1.
+    int GetEventFd() const
+    {
+        return m_EventFd;
+    }
+
+    // ------------------------------------------------------------ Producer
+
+    // Returns false if the queue is full, the event is dropped in that case.
+    bool Push(const APC40InputEvent& event)
+    {
+        size_t tail{ m_Tail.load(std::memory_order_relaxed) };
+
+        if (tail - m_CachedHead == Capacity)
+        {
+            m_CachedHead = m_Head.load(std::memory_order_acquire);
+
+            if (tail - m_CachedHead == Capacity)
+                return false;
+        }
+
+        m_Events[tail & (Capacity - 1)] = event;
+        m_Tail.store(tail + 1, std::memory_order_release);
+
+        if (m_EventFd >= 0)
+            Signal(tail);
+
+        return true;
+    }
+
+    bool Push(const APC40Input& input, uint32_t timestamp)
+    {
+        return Push(APC40InputEvent::FromInput(input, timestamp));
+    }
+
+    bool Push(const APC40Input& input)
+    {
+        return Push(APC40InputEvent::FromInput(input, APC40TimestampMicroseconds()));
+    }
+
+    // ------------------------------------------------------------ Consumer
+
+    // Pops up to max_events events. Returns the number of events popped.
+    // With an eventfd, the eventfd is reset once the queue is empty.
+    size_t Pop(APC40InputEvent* events, size_t max_events)
+    {
+        size_t head{ m_Head.load(std::memory_order_relaxed) };
+        size_t tail{ m_Tail.load(std::memory_order_acquire) };
+
+        size_t count{ std::min(tail - head, max_events) };
+
+        for (size_t n = 0; n < count; ++n)
+            events[n] = m_Events[(head + n) & (Capacity - 1)];
+
+        m_Head.store(head + count, std::memory_order_release);
+
+        if (m_EventFd >= 0 && head + count == tail)
+            ResetEventFd(tail);
+
+        return count;
+    }
+
+    // Calls func(const APC40InputEvent&) for every event that was queued when Drain was called.
+    // Events pushed meanwhile are left for the next call, so a fast producer can't keep the consumer here.
+    // With an eventfd, the eventfd is reset if the queue is empty afterwards. Returns the number of events.
+    template <typename Func>
+    size_t Drain(Func&& func)
+    {
+        size_t head{ m_Head.load(std::memory_order_relaxed) };
+        size_t tail{ m_Tail.load(std::memory_order_acquire) };
+
+        for (size_t n = head; n != tail; ++n)
+            func(static_cast<const APC40InputEvent&>(m_Events[n & (Capacity - 1)]));
+
+        m_Head.store(tail, std::memory_order_release);
+
+        if (m_EventFd >= 0)
+            ResetEventFd(tail);
+
+        return tail - head;
+    }
+
+    bool IsEmpty() const
+    {
+        return m_Head.load(std::memory_order_acquire) == m_Tail.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t GetCapacity()
+    {
+        return Capacity;
+    }
+
+private:
+
+    // Resets the eventfd if the queue is empty at head, so level triggered polling doesn't spin.
+    // The fd stays readable as long as events are queued.
+    void ResetEventFd(size_t head)
+    {
+#if defined __linux__
+        // Pairs with the fence in Signal: either the producer sees the queue empty and signals,
+        // or we see its event here.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (m_Tail.load(std::memory_order_acquire) != head)
+            return;
+
+        uint64_t counter;
+
+        if (read(m_EventFd, &counter, sizeof(counter)) < 0)
+            counter = 0;
+
+        // An event pushed before the read may have signalled into the counter that was just reset
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (m_Tail.load(std::memory_order_acquire) != head)
+        {
+            uint64_t one{ 1 };
+
+            if (write(m_EventFd, &one, sizeof(one)) < 0)
+                return;
+        }
+#else
+        (void)head;
+#endif
+    }
+
+    // Wakes the consumer if it may have seen the queue empty.
+    void Signal(size_t tail)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (m_Head.load(std::memory_order_relaxed) != tail)
+            return;
+
+#if defined __linux__
+        uint64_t one{ 1 };
+
+        if (write(m_EventFd, &one, sizeof(one)) < 0)
+            return;
+#endif
+    }
+
+    // Set up before producer and consumer start and only read afterwards, so it gets a line of its own.
+    alignas(APC40_CACHE_LINE_SIZE) int m_EventFd{ -1 };
+
+    // Producer and consumer indices live on separate cache lines, each next to the data only its owner touches.
+    alignas(APC40_CACHE_LINE_SIZE) std::atomic<size_t> m_Tail{ 0 };
+    size_t m_CachedHead{ 0 };
+
+    alignas(APC40_CACHE_LINE_SIZE) std::atomic<size_t> m_Head{ 0 };
+
+    alignas(APC40_CACHE_LINE_SIZE) APC40InputEvent m_Events[Capacity];
+};
+
+// ------------------------------------------------------------ EOF
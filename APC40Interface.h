@@ -1,9 +1,27 @@
 #pragma once
 
-#include <map>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <algorithm>
 
+#if defined _MSC_VER
+#include <intrin.h>
+#endif
+
+// Define APC40_NO_SIMD to force the scalar code paths.
+#if !defined APC40_NO_SIMD && defined __AVX2__
+#define APC40_SIMD_AVX2
+#include <immintrin.h>
+#elif !defined APC40_NO_SIMD && (defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2))
+#define APC40_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
 // ------------------------------------------------------------
 /*
 
@@ -234,295 +252,1530 @@ constexpr eAPC40Control APC40StripControl(eAPC40Control control)
     return control;
 }
 
-// ------------------------------------------------------------
+// ------------------------------------------------------------ Midi Mapping
 
-struct APC40Input
+// Status byte and first data byte of a control's midi message.
+struct APC40MidiMapping
 {
     eAPC40Control control = eAPC40Control::Invalid;
-    int value = 0;
-    bool pressed = false;
+    unsigned char status = 0;
+    unsigned char data1 = 0;
 };
 
-// ------------------------------------------------------------ 
+// Note numbers of the pad rows. Columns 0-7 send on midi channels 0-7.
+constexpr unsigned char APC40_PAD_ROW_NOTES[APC40_PAD_SIZE_Y] = { 0x35, 0x36, 0x37, 0x38, 0x39, 0x34, 0x33, 0x32, 0x31, 0x30 };
 
-class APC40Interface
+// Note numbers of the scene launch column (pad column 8, channel 0). Rows 7-9 don't exist.
+constexpr int APC40_PAD_NUM_SCENE_ROWS = 7;
+constexpr unsigned char APC40_PAD_SCENE_NOTES[APC40_PAD_NUM_SCENE_ROWS] = { 0x52, 0x53, 0x54, 0x55, 0x56, 0x51, 0x50 };
+
+// Input controls that aren't part of a group (all on channel 0).
+constexpr APC40MidiMapping APC40_INPUT_MAPPINGS[] =
 {
-public:
+    { eAPC40Control::TrackPan,              0x90, 0x57 },
+    { eAPC40Control::TrackSendA,            0x90, 0x58 },
+    { eAPC40Control::TrackSendB,            0x90, 0x59 },
+    { eAPC40Control::TrackSendC,            0x90, 0x5A },
+    { eAPC40Control::Shift,                 0x90, 0x62 },
+    { eAPC40Control::BankUp,                0x90, 0x5E },
+    { eAPC40Control::BankDown,              0x90, 0x5F },
+    { eAPC40Control::BankLeft,              0x90, 0x61 },
+    { eAPC40Control::BankRight,             0x90, 0x60 },
+    { eAPC40Control::TapTempo,              0x90, 0x63 },
+    { eAPC40Control::NudgeDown,             0x90, 0x65 },
+    { eAPC40Control::NudgeUp,               0x90, 0x64 },
+    { eAPC40Control::DeviceClipTrack,       0x90, 0x3A },
+    { eAPC40Control::DeviceToggle,          0x90, 0x3B },
+    { eAPC40Control::DeviceLeft,            0x90, 0x3C },
+    { eAPC40Control::DeviceRight,           0x90, 0x3D },
+    { eAPC40Control::DeviceDetailView,      0x90, 0x3E },
+    { eAPC40Control::DeviceRecQuantization, 0x90, 0x3F },
+    { eAPC40Control::DeviceMidiOverdub,     0x90, 0x40 },
+    { eAPC40Control::DeviceMetronome,       0x90, 0x41 },
+    { eAPC40Control::Play,                  0x90, 0x5B },
+    { eAPC40Control::Stop,                  0x90, 0x5C },
+    { eAPC40Control::Rec,                   0x90, 0x5D },
+    { APC40PackControl(eAPC40Control::VolumeSlider, 8), 0xB0, 0x0E }, // Master
+    { eAPC40Control::CrossfadeSlider,       0xB0, 0x0F },
+    { eAPC40Control::CueLevelKnob,          0xB0, 0x2F },
+};
 
-    APC40Interface()
+// The input decode table covers status bytes 0x80 - 0xBF (note off, note on, aftertouch, cc) and data bytes 0x00 - 0x7F.
+// Note off rows mirror the note on rows. Each entry is a control or APC40_INPUT_TABLE_NONE.
+constexpr int APC40_INPUT_TABLE_STATUS_MIN = 0x80;
+constexpr int APC40_INPUT_TABLE_NUM_STATUS = 0x40;
+constexpr size_t APC40_INPUT_TABLE_SIZE = APC40_INPUT_TABLE_NUM_STATUS * 0x80;
+constexpr unsigned char APC40_INPUT_TABLE_NONE = 0xFF;
+
+// Extra entries at the end of the table, so vectorized lookups can read 4 bytes at any index.
+constexpr size_t APC40_INPUT_TABLE_PADDING = 3;
+
+static_assert(static_cast<int>(eAPC40Control::MaxValue) < APC40_INPUT_TABLE_NONE, "Controls must fit into the input decode table");
+
+constexpr size_t APC40InputTableIndex(int status, int data1)
+{
+    return (static_cast<size_t>(status - APC40_INPUT_TABLE_STATUS_MIN) << 7) | static_cast<size_t>(data1);
+}
+
+constexpr std::array<unsigned char, APC40_INPUT_TABLE_SIZE + APC40_INPUT_TABLE_PADDING> APC40BuildInputTable()
+{
+    std::array<unsigned char, APC40_INPUT_TABLE_SIZE + APC40_INPUT_TABLE_PADDING> table{};
+
+    for (size_t i = 0; i < table.size(); ++i)
+        table[i] = APC40_INPUT_TABLE_NONE;
+
+    for (int y = 0; y < APC40_PAD_SIZE_Y; ++y)
     {
-        memset(m_CurrentState, 255, sizeof(m_CurrentState));
-        memset(m_DesiredState, 0, sizeof(m_DesiredState));
+        for (int x = 0; x < APC40_PAD_SIZE_X - 1; ++x)
+            table[APC40InputTableIndex(0x90 + x, APC40_PAD_ROW_NOTES[y])] = static_cast<unsigned char>(APC40PackControl(eAPC40Control::Pad, x, y));
     }
 
-    ~APC40Interface()
-    {
+    for (int y = 0; y < APC40_PAD_NUM_SCENE_ROWS; ++y)
+        table[APC40InputTableIndex(0x90, APC40_PAD_SCENE_NOTES[y])] = static_cast<unsigned char>(APC40PackControl(eAPC40Control::Pad, APC40_PAD_SIZE_X - 1, y));
 
-    }
+    for (int i = 0; i < APC40_NUM_SLIDERS - 1; ++i)
+        table[APC40InputTableIndex(0xB0 + i, 0x07)] = static_cast<unsigned char>(APC40PackControl(eAPC40Control::VolumeSlider, i));
 
-    void GetInitMessage(std::vector<unsigned char>& message)
+    for (int i = 0; i < APC40_NUM_KNOBS; ++i)
     {
-        message =
-        {
-            0xF0, // MIDI excl start
-            0x47, // Manufacturer ID
-            0x7F, // Device ID
-            0x73, // Product Model ID
-            0x60, // Msg Type ID (0x60=Init)
-            0x00, // Num Data Bytes (most sign.)
-            0x04, // Num Data Bytes (least sign.)
-            0x42, // Device Mode (0x40=unset, 0x41=Ableton, 0x42=Ableton with full ctrl)
-            0x01, // PC Ver Major
-            0x01, // PC Ver Minor
-            0x01, // PC Bug Fix Lvl
-            0xF7  // MIDI excl end
-        };
+        table[APC40InputTableIndex(0xB0, 0x30 + i)] = static_cast<unsigned char>(APC40PackControl(eAPC40Control::TrackKnobValue, i));
+        table[APC40InputTableIndex(0xB0, 0x10 + i)] = static_cast<unsigned char>(APC40PackControl(eAPC40Control::DeviceKnobValue, i));
     }
 
-    // ------------------------------------------------------------ Output
+    for (const APC40MidiMapping& mapping : APC40_INPUT_MAPPINGS)
+        table[APC40InputTableIndex(mapping.status, mapping.data1)] = static_cast<unsigned char>(mapping.control);
 
-    // Sets the mode of an APC40 control (leds, knob mode, etc).
-    bool SetControlMode(eAPC40Control control, eAPC40LEDMode mode)
+    // Note off uses the same controls as note on
+    for (int status = 0x80; status < 0x90; ++status)
     {
-        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
-            return false;
+        for (int data1 = 0; data1 < 0x80; ++data1)
+            table[APC40InputTableIndex(status, data1)] = table[APC40InputTableIndex(status + 0x10, data1)];
+    }
 
-        m_DesiredState[static_cast<size_t>(control)] = static_cast<unsigned char>(std::clamp(static_cast<int>(mode), 0, 127));
+    return table;
+}
 
-        return true;
-    }
+// Output controls that aren't part of a group (all on channel 0).
+constexpr APC40MidiMapping APC40_OUTPUT_MAPPINGS[] =
+{
+    { eAPC40Control::TrackPan,              0x90, 0x57 },
+    { eAPC40Control::TrackSendA,            0x90, 0x58 },
+    { eAPC40Control::TrackSendB,            0x90, 0x59 },
+    { eAPC40Control::TrackSendC,            0x90, 0x5A },
+    { eAPC40Control::DeviceClipTrack,       0x90, 0x3A },
+    { eAPC40Control::DeviceToggle,          0x90, 0x3B },
+    { eAPC40Control::DeviceLeft,            0x90, 0x3C },
+    { eAPC40Control::DeviceRight,           0x90, 0x3D },
+    { eAPC40Control::DeviceDetailView,      0x90, 0x3E },
+    { eAPC40Control::DeviceRecQuantization, 0x90, 0x3F },
+    { eAPC40Control::DeviceMidiOverdub,     0x90, 0x40 },
+    { eAPC40Control::DeviceMetronome,       0x90, 0x41 },
+};
 
-    // Sets the mode of an APC40 control (leds, knob mode, etc).
-    bool SetControlMode(eAPC40Control control, eAPC40KnobMode mode)
-    {
-        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
-            return false;
+// Pre-encoded status and first data byte of an output control. A status of 0 means the control has no output.
+struct APC40MidiAddress
+{
+    unsigned char status = 0;
+    unsigned char data1 = 0;
+};
 
-        m_DesiredState[static_cast<size_t>(control)] = static_cast<unsigned char>(std::clamp(static_cast<int>(mode), 0, 127));
+constexpr std::array<APC40MidiAddress, static_cast<size_t>(eAPC40Control::MaxValue)> APC40BuildOutputTable()
+{
+    std::array<APC40MidiAddress, static_cast<size_t>(eAPC40Control::MaxValue)> table{};
 
-        return true;
+    for (int y = 0; y < APC40_PAD_SIZE_Y; ++y)
+    {
+        for (int x = 0; x < APC40_PAD_SIZE_X - 1; ++x)
+            table[static_cast<size_t>(APC40PackControl(eAPC40Control::Pad, x, y))] = { static_cast<unsigned char>(0x90 + x), APC40_PAD_ROW_NOTES[y] };
     }
 
-    // Sets the raw value of an APC40 control (ie knob led count), 0 - 127.
-    bool SetControlValue(eAPC40Control control, int value)
+    for (int y = 0; y < APC40_PAD_NUM_SCENE_ROWS; ++y)
+        table[static_cast<size_t>(APC40PackControl(eAPC40Control::Pad, APC40_PAD_SIZE_X - 1, y))] = { 0x90, APC40_PAD_SCENE_NOTES[y] };
+
+    for (int i = 0; i < APC40_NUM_KNOBS; ++i)
     {
-        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
-            return false;
+        table[static_cast<size_t>(APC40PackControl(eAPC40Control::TrackKnobMode, i))] = { 0xB0, static_cast<unsigned char>(0x38 + i) };
+        table[static_cast<size_t>(APC40PackControl(eAPC40Control::TrackKnobValue, i))] = { 0xB0, static_cast<unsigned char>(0x30 + i) };
+        table[static_cast<size_t>(APC40PackControl(eAPC40Control::DeviceKnobMode, i))] = { 0xB0, static_cast<unsigned char>(0x18 + i) };
+        table[static_cast<size_t>(APC40PackControl(eAPC40Control::DeviceKnobValue, i))] = { 0xB0, static_cast<unsigned char>(0x10 + i) };
+    }
 
-        m_DesiredState[static_cast<size_t>(control)] = static_cast<unsigned char>(std::clamp(value, 0, 127));
+    for (const APC40MidiMapping& mapping : APC40_OUTPUT_MAPPINGS)
+        table[static_cast<size_t>(mapping.control)] = { mapping.status, mapping.data1 };
 
-        return true;
-    }
+    return table;
+}
 
-    // Gets the mode of an APC40 control
-    bool GetControlMode(eAPC40Control control, eAPC40LEDMode& mode)
-    {
-        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
-            return false;
+// Indexed by control, unmapped controls have a status of 0.
+constexpr std::array<APC40MidiAddress, static_cast<size_t>(eAPC40Control::MaxValue)> APC40_OUTPUT_TABLE{ APC40BuildOutputTable() };
 
-        mode = static_cast<eAPC40LEDMode>(m_DesiredState[static_cast<size_t>(control)]);
+// Encodes the output message of a control, without needing an interface. Returns false if the control has no output.
+constexpr bool APC40TranslateOutputMessage(eAPC40Control control, int value, unsigned char& b1, unsigned char& b2, unsigned char& b3)
+{
+    if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+        return false;
 
-        return true;
-    }
+    const APC40MidiAddress& address{ APC40_OUTPUT_TABLE[static_cast<size_t>(control)] };
 
-    // Gets the mode of an APC40 control
-    bool GetControlMode(eAPC40Control control, eAPC40KnobMode& mode)
-    {
-        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
-            return false;
+    if (address.status == 0)
+        return false;
 
-        mode = static_cast<eAPC40KnobMode>(m_DesiredState[static_cast<size_t>(control)]);
+    b1 = address.status;
+    b2 = address.data1;
+    b3 = static_cast<unsigned char>(std::clamp(value, 0, 127));
 
-        return true;
-    }
+    return true;
+}
 
-    // Get sthe raw value of an APC40 control
-    bool GetControlValue(eAPC40Control control, int& value)
+// ------------------------------------------------------------ Control Masks
+
+constexpr size_t APC40_NUM_CONTROLS = static_cast<size_t>(eAPC40Control::MaxValue);
+constexpr size_t APC40_CONTROL_MASK_WORDS = (APC40_NUM_CONTROLS + 63) / 64;
+
+// Index of the lowest set bit, value must not be 0.
+inline unsigned int APC40CountTrailingZeros(uint64_t value)
+{
+#if defined _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return static_cast<unsigned int>(index);
+#else
+    return static_cast<unsigned int>(__builtin_ctzll(value));
+#endif
+}
+
+// One bit per control.
+struct APC40ControlMask
+{
+    uint64_t words[APC40_CONTROL_MASK_WORDS]{};
+
+    constexpr void Set(size_t index) { words[index >> 6] |= uint64_t{ 1 } << (index & 63); }
+    constexpr void Reset(size_t index) { words[index >> 6] &= ~(uint64_t{ 1 } << (index & 63)); }
+    constexpr bool Test(size_t index) const { return (words[index >> 6] >> (index & 63)) & 1; }
+
+    constexpr bool Any() const
     {
-        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
-            return false;
+        uint64_t any{ 0 };
 
-        value = static_cast<int>(m_DesiredState[static_cast<size_t>(control)]);
+        for (size_t w = 0; w < APC40_CONTROL_MASK_WORDS; ++w)
+            any |= words[w];
 
-        return true;
+        return any != 0;
     }
 
-    // Should be called if the APC40 is disconnected.
-    // That way, the library knows to send the midi messages required to restore the state on reconnect.
-    void ResetCurrentState()
+    constexpr void Clear()
     {
-        memset(m_CurrentState, 255, sizeof(m_CurrentState));
+        for (size_t w = 0; w < APC40_CONTROL_MASK_WORDS; ++w)
+            words[w] = 0;
     }
 
-    // Should be called if you actually want to reset all controls.
-    void ResetDesiredState()
+    constexpr APC40ControlMask& operator|=(const APC40ControlMask& other)
     {
-        memset(m_DesiredState, 0, sizeof(m_DesiredState));
+        for (size_t w = 0; w < APC40_CONTROL_MASK_WORDS; ++w)
+            words[w] |= other.words[w];
+
+        return *this;
     }
 
-    // Gets the Midi Message queue. Set update_state to false if you don't want to keep this state.
-    // Midi messages are only generated on changed values (current device state vs. desired device state).
-    // If running status is supported by the device (which depends on firmware version), you can save some bandwidth by enabling it.
-    void GetMidiMessages(std::vector<unsigned char>& messages, bool update_state, bool running_status, unsigned int* num_messages = nullptr)
+    constexpr APC40ControlMask& operator&=(const APC40ControlMask& other)
     {
-        messages.clear();
+        for (size_t w = 0; w < APC40_CONTROL_MASK_WORDS; ++w)
+            words[w] &= other.words[w];
 
-        if (num_messages)
-            *num_messages = 0;
+        return *this;
+    }
+
+    // Index of the lowest set bit, or APC40_CONTROL_MASK_WORDS * 64 if no bit is set.
+    size_t First() const
+    {
+        for (size_t w = 0; w < APC40_CONTROL_MASK_WORDS; ++w)
+        {
+            if (words[w] != 0)
+                return w * 64 + APC40CountTrailingZeros(words[w]);
+        }
 
-        unsigned char b1_last{ 255 };
+        return APC40_CONTROL_MASK_WORDS * 64;
+    }
 
-        for (size_t i = 0; i < static_cast<size_t>(eAPC40Control::MaxValue); ++i)
+    // Calls func(size_t index) for every set bit in ascending order.
+    template <typename Func>
+    void ForEach(Func&& func) const
+    {
+        for (size_t w = 0; w < APC40_CONTROL_MASK_WORDS; ++w)
         {
-            if (m_CurrentState[i] == m_DesiredState[i])
-                continue;
+            for (uint64_t bits{ words[w] }; bits != 0; bits &= bits - 1)
+                func(w * 64 + APC40CountTrailingZeros(bits));
+        }
+    }
+};
 
-            unsigned char b1;
-            unsigned char b2;
-            unsigned char b3;
+constexpr APC40ControlMask operator~(APC40ControlMask a)
+{
+    for (size_t w = 0; w < APC40_CONTROL_MASK_WORDS; ++w)
+        a.words[w] = ~a.words[w];
 
-            if (TranslateOutputMessage(static_cast<eAPC40Control>(i), m_DesiredState[i], b1, b2, b3))
-            {
-                if (running_status)
-                {
-                    if (b1 != b1_last)
-                    {
-                        messages.emplace_back(b1);
-                        b1_last = b1;
-                    }
-                }
-                else
-                {
-                    messages.emplace_back(b1);
-                }
+    return a;
+}
 
-                messages.emplace_back(b2);
-                messages.emplace_back(b3);
+constexpr APC40ControlMask operator&(APC40ControlMask a, const APC40ControlMask& b) { return a &= b; }
+constexpr APC40ControlMask operator|(APC40ControlMask a, const APC40ControlMask& b) { return a |= b; }
 
-                if (num_messages)
-                    ++(*num_messages);
-            }
-        }
+// Mask with all bits from index (inclusive) upwards set.
+constexpr APC40ControlMask APC40ControlMaskFrom(size_t index)
+{
+    APC40ControlMask mask{};
 
-        if (update_state)
-            memcpy(m_CurrentState, m_DesiredState, static_cast<size_t>(eAPC40Control::MaxValue));
+    for (size_t w = 0; w < APC40_CONTROL_MASK_WORDS; ++w)
+    {
+        if (index <= w * 64)
+            mask.words[w] = ~uint64_t{ 0 };
+        else if (index < (w + 1) * 64)
+            mask.words[w] = ~uint64_t{ 0 } << (index - w * 64);
     }
 
-    // ------------------------------------------------------------ Message Translation (Midi <-> APC)
+    return mask;
+}
 
-    bool TranslateInputMessage(unsigned int midi_message, APC40Input& input_message)
-    {
-        unsigned char midi_message_arr[3]{ ((midi_message >> 0) & 0xFF), ((midi_message >> 8) & 0xFF), ((midi_message >> 16) & 0xFF) };
+constexpr APC40ControlMask APC40BuildOutputMask()
+{
+    APC40ControlMask mask{};
 
-        return TranslateInputMessage(midi_message_arr, 3, input_message);
+    for (size_t i = 0; i < APC40_NUM_CONTROLS; ++i)
+    {
+        if (APC40_OUTPUT_TABLE[i].status != 0)
+            mask.Set(i);
     }
 
-    // midi_message is an array and always expected to be of size 3 or more (any indexes above 2 are ignored).
-    bool TranslateInputMessage(unsigned char* midi_message, unsigned int midi_message_size, APC40Input& input_message)
-    {
-        if (midi_message_size < 3)
-            return false;
+    return mask;
+}
+
+// All controls that have an output message.
+constexpr APC40ControlMask APC40_OUTPUT_CONTROL_MASK{ APC40BuildOutputMask() };
+
+// Output controls sharing the same status byte. Pad columns 0-7 are on channels 0-7, everything else on channel 0.
+struct APC40StatusGroup
+{
+    unsigned char status = 0;
+    APC40ControlMask mask{};
+};
+
+constexpr size_t APC40_NUM_OUTPUT_STATUS_GROUPS = 9;
+
+constexpr std::array<APC40StatusGroup, APC40_NUM_OUTPUT_STATUS_GROUPS> APC40BuildOutputStatusGroups()
+{
+    constexpr std::array<APC40MidiAddress, APC40_NUM_CONTROLS> table{ APC40BuildOutputTable() };
+
+    std::array<APC40StatusGroup, APC40_NUM_OUTPUT_STATUS_GROUPS> groups{};
 
-        int value{ 0 };
-        bool pressed{ true };
+    for (size_t g = 0; g < APC40_NUM_OUTPUT_STATUS_GROUPS - 1; ++g)
+        groups[g].status = static_cast<unsigned char>(0x90 + g);
 
-        int b1 = static_cast<int>(midi_message[0]);
-        int b2 = static_cast<int>(midi_message[1]);
-        int b3 = static_cast<int>(midi_message[2]);
+    groups[APC40_NUM_OUTPUT_STATUS_GROUPS - 1].status = 0xB0;
 
-        if (b1 >= 0x80 && b1 <= 0x8F)
+    for (size_t i = 0; i < APC40_NUM_CONTROLS; ++i)
+    {
+        for (APC40StatusGroup& group : groups)
         {
-            b1 += 0x10;
-            pressed = false;
+            if (table[i].status != 0 && table[i].status == group.status)
+                group.mask.Set(i);
         }
+    }
 
-        auto it{ ms_ControlInputMap.find({ b1, b2 }) };
+    return groups;
+}
 
-        if (it == ms_ControlInputMap.end())
-            return false;
+constexpr std::array<APC40StatusGroup, APC40_NUM_OUTPUT_STATUS_GROUPS> APC40_OUTPUT_STATUS_GROUPS{ APC40BuildOutputStatusGroups() };
 
-        input_message.control = static_cast<eAPC40Control>(it->second);
-        input_message.value = std::clamp(b3, 0, 127);
-        input_message.pressed = pressed;
+constexpr APC40ControlMask APC40BuildButtonInputMask()
+{
+    constexpr std::array<unsigned char, APC40_INPUT_TABLE_SIZE + APC40_INPUT_TABLE_PADDING> table{ APC40BuildInputTable() };
 
-        return true;
-    }
+    APC40ControlMask mask{};
 
-    bool TranslateOutputMessage(eAPC40Control control, int value, unsigned char& b1, unsigned char& b2, unsigned char& b3)
+    for (int data1 = 0; data1 < 0x80; ++data1)
     {
-        auto it{ ms_ControlOutputMap.find(static_cast<int>(control)) };
+        for (int status = 0x90; status < 0xA0; ++status)
+        {
+            if (table[APC40InputTableIndex(status, data1)] != APC40_INPUT_TABLE_NONE)
+                mask.Set(table[APC40InputTableIndex(status, data1)]);
+        }
+    }
 
-        if (it == ms_ControlOutputMap.end())
-            return false;
+    return mask;
+}
 
-        b1 = static_cast<unsigned char>(it->second.first);
-        b2 = static_cast<unsigned char>(it->second.second);
-        b3 = static_cast<unsigned char>(std::clamp(value, 0, 127));
+// Input controls that send note on/off (buttons and pads), as opposed to cc (sliders and knobs).
+constexpr APC40ControlMask APC40_BUTTON_INPUT_MASK{ APC40BuildButtonInputMask() };
 
-        return true;
+// Mask of the pads inside a rectangle, clipped to the pad.
+constexpr APC40ControlMask APC40PadRectMask(int x, int y, int width, int height)
+{
+    APC40ControlMask mask{};
+
+    for (int py = std::max(y, 0); py < std::min(y + height, APC40_PAD_SIZE_Y); ++py)
+    {
+        for (int px = std::max(x, 0); px < std::min(x + width, APC40_PAD_SIZE_X); ++px)
+            mask.Set(static_cast<size_t>(APC40PackControl(eAPC40Control::Pad, px, py)));
     }
 
-    // ------------------------------------------------------------ Utility
+    return mask;
+}
 
-    // Gets an x, y coord for a position on the pad's circumference (0-31) - scene launch excluded
-    bool GetPadCircularPos(int pos, int& x, int& y)
+constexpr APC40ControlMask APC40PadRowMask(int y)
+{
+    return APC40PadRectMask(0, y, APC40_PAD_SIZE_X, 1);
+}
+
+constexpr APC40ControlMask APC40PadColumnMask(int x)
+{
+    return APC40PadRectMask(x, 0, 1, APC40_PAD_SIZE_Y);
+}
+
+constexpr APC40ControlMask APC40_PAD_MASK{ APC40PadRectMask(0, 0, APC40_PAD_SIZE_X, APC40_PAD_SIZE_Y) };
+
+// Mask of all controls that strip to group, see APC40StripControl.
+constexpr APC40ControlMask APC40ControlGroupMask(eAPC40Control group)
+{
+    APC40ControlMask mask{};
+
+    for (size_t i = 0; i < APC40_NUM_CONTROLS; ++i)
     {
-        if (pos < 0 || pos >= 32)
-            return false;
+        if (APC40StripControl(static_cast<eAPC40Control>(i)) == group)
+            mask.Set(i);
+    }
 
-        if (pos >= 0 && pos <= 7) // Horizontal Top
-        {
-            x = pos;
-            y = 0;
-        }
-        else if (pos >= 16 && pos <= 23) // Horizontal Bottom
-        {
-            x = 7 - (pos - 16);
-            y = 9;
-        }
-        else if (pos >= 7 && pos <= 16) // Vertical Right
-        {
-            x = 7;
-            y = pos - 7;
-        }
-        else if (pos >= 23 && pos <= 31) // Vertical Left
-        {
-            x = 0;
-            y = 9 - (pos - 23);
-        }
+    return mask;
+}
 
-        return true;
+// ------------------------------------------------------------ State Diff
+
+// State arrays are padded to a multiple of the widest vector and aligned to it.
+// The padding bytes are never written and compare equal.
+constexpr size_t APC40_STATE_ALIGNMENT = 32;
+constexpr size_t APC40_STATE_SIZE = (APC40_NUM_CONTROLS + APC40_STATE_ALIGNMENT - 1) / APC40_STATE_ALIGNMENT * APC40_STATE_ALIGNMENT;
+
+static_assert(APC40_STATE_SIZE <= APC40_CONTROL_MASK_WORDS * 64, "State padding must fit into a control mask");
+
+// Sets a bit for every byte that differs between two state arrays of APC40_STATE_SIZE bytes.
+inline APC40ControlMask APC40DiffStatesScalar(const unsigned char* a, const unsigned char* b)
+{
+    APC40ControlMask mask{};
+
+    for (size_t i = 0; i < APC40_STATE_SIZE; ++i)
+        mask.words[i >> 6] |= static_cast<uint64_t>(a[i] != b[i]) << (i & 63);
+
+    return mask;
+}
+
+// Same as APC40DiffStatesScalar, using SSE2 or AVX2 when compiled for it.
+inline APC40ControlMask APC40DiffStates(const unsigned char* a, const unsigned char* b)
+{
+#if defined APC40_SIMD_AVX2
+    APC40ControlMask mask{};
+
+    for (size_t i = 0; i < APC40_STATE_SIZE; i += 32)
+    {
+        __m256i eq{ _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i))) };
+        uint32_t diff{ ~static_cast<uint32_t>(_mm256_movemask_epi8(eq)) };
+
+        mask.words[i >> 6] |= static_cast<uint64_t>(diff) << (i & 63);
     }
 
-    bool IsValidPadPos(int x, int y, bool allow_scene = true)
+    return mask;
+#elif defined APC40_SIMD_SSE2
+    APC40ControlMask mask{};
+
+    for (size_t i = 0; i < APC40_STATE_SIZE; i += 16)
     {
-        if (allow_scene && x == 8 && y >= 0 && y < 7)
-            return true;
+        __m128i eq{ _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))) };
+        uint32_t diff{ ~static_cast<uint32_t>(_mm_movemask_epi8(eq)) & 0xFFFF };
 
-        if (x < 0 || x > 7 || y < 0 || y > 9)
-            return false;
+        mask.words[i >> 6] |= static_cast<uint64_t>(diff) << (i & 63);
+    }
 
-        return true;
+    return mask;
+#else
+    return APC40DiffStatesScalar(a, b);
+#endif
+}
+
+// ------------------------------------------------------------ Midi Buffers
+
+// Puts the APC40 into Ableton Full Control mode. Needs to be sent as SysEx.
+constexpr std::array<unsigned char, 12> APC40_INIT_MESSAGE
+{
+    0xF0, // MIDI excl start
+    0x47, // Manufacturer ID
+    0x7F, // Device ID
+    0x73, // Product Model ID
+    0x60, // Msg Type ID (0x60=Init)
+    0x00, // Num Data Bytes (most sign.)
+    0x04, // Num Data Bytes (least sign.)
+    0x42, // Device Mode (0x40=unset, 0x41=Ableton, 0x42=Ableton with full ctrl)
+    0x01, // PC Ver Major
+    0x01, // PC Ver Minor
+    0x01, // PC Bug Fix Lvl
+    0xF7  // MIDI excl end
+};
+
+// Knob ring type the APC40 uses after the init message.
+constexpr eAPC40KnobMode APC40_INIT_KNOB_MODE = eAPC40KnobMode::Single;
+
+// Device state right after the init message: all LEDs and rings off, knob ring types at their default.
+constexpr std::array<unsigned char, APC40_STATE_SIZE> APC40BuildInitState()
+{
+    std::array<unsigned char, APC40_STATE_SIZE> state{};
+
+    for (int i = 0; i < APC40_NUM_KNOBS; ++i)
+    {
+        state[static_cast<size_t>(APC40PackControl(eAPC40Control::TrackKnobMode, i))] = static_cast<unsigned char>(APC40_INIT_KNOB_MODE);
+        state[static_cast<size_t>(APC40PackControl(eAPC40Control::DeviceKnobMode, i))] = static_cast<unsigned char>(APC40_INIT_KNOB_MODE);
     }
 
-    int GetKnobValueLEDCount(unsigned char value, eAPC40KnobMode mode)
+    return state;
+}
+
+constexpr std::array<unsigned char, APC40_STATE_SIZE> APC40_INIT_STATE{ APC40BuildInitState() };
+
+// Worst case size of the midi buffer generated by APC40Interface::GetMidiMessages.
+constexpr size_t APC40_MAX_MIDI_BUFFER_SIZE = APC40_NUM_CONTROLS * 3;
+
+using APC40MidiBuffer = std::array<unsigned char, APC40_MAX_MIDI_BUFFER_SIZE>;
+
+// Priority lanes of APC40Interface::GetPrioritizedMidiMessages, highest priority first.
+enum class eAPC40OutputLane
+{
+    Transport = 0, // Clip stop row, track pan/send and device/transport buttons
+    Pad,           // Remaining pad LEDs
+    KnobRing,      // Knob modes and values
+
+    Count
+};
+
+constexpr std::array<APC40ControlMask, static_cast<size_t>(eAPC40OutputLane::Count)> APC40BuildOutputLaneMasks()
+{
+    std::array<APC40ControlMask, static_cast<size_t>(eAPC40OutputLane::Count)> lanes{};
+
+    APC40ControlMask& transport{ lanes[static_cast<size_t>(eAPC40OutputLane::Transport)] };
+    APC40ControlMask& pad{ lanes[static_cast<size_t>(eAPC40OutputLane::Pad)] };
+    APC40ControlMask& knob_ring{ lanes[static_cast<size_t>(eAPC40OutputLane::KnobRing)] };
+
+    constexpr int clip_stop_row{ 5 };
+
+    for (int y = 0; y < APC40_PAD_SIZE_Y; ++y)
     {
-        switch (mode)
+        for (int x = 0; x < APC40_PAD_SIZE_X; ++x)
         {
-        case eAPC40KnobMode::Single:
-            if (value < 1) return 0;
-            if (value < 10) return 1;
-            if (value < 19) return 2;
-            if (value < 28) return 3;
-            if (value < 37) return 4;
-            if (value < 46) return 5;
-            if (value < 55) return 6;
-            if (value < 64) return 7;
-            if (value < 72) return 8;
-            if (value < 81) return 9;
-            if (value < 90) return 10;
-            if (value < 99) return 11;
-            if (value < 108) return 12;
+            size_t i{ static_cast<size_t>(APC40PackControl(eAPC40Control::Pad, x, y)) };
+
+            if (y == clip_stop_row)
+                transport.Set(i);
+            else
+                pad.Set(i);
+        }
+    }
+
+    for (size_t i = static_cast<size_t>(eAPC40Control::TrackPan); i < static_cast<size_t>(eAPC40Control::VolumeSlider); ++i)
+        transport.Set(i);
+
+    for (size_t i = static_cast<size_t>(eAPC40Control::TrackKnobMode); i < APC40_NUM_CONTROLS; ++i)
+        knob_ring.Set(i);
+
+    for (APC40ControlMask& lane : lanes)
+        lane &= APC40_OUTPUT_CONTROL_MASK;
+
+    return lanes;
+}
+
+constexpr std::array<APC40ControlMask, static_cast<size_t>(eAPC40OutputLane::Count)> APC40_OUTPUT_LANE_MASKS{ APC40BuildOutputLaneMasks() };
+
+// A control left pending by this many budgeted flushes is sent before all lanes.
+constexpr unsigned char APC40_OUTPUT_MAX_AGE = 4;
+
+// Approximate throughput of a 31.25 kbaud DIN midi link.
+constexpr size_t APC40_DIN_MIDI_BYTES_PER_SECOND = 3125;
+
+// Messages written by APC40Interface::PrepareMidiMessages, in the order they appear in the buffer.
+// Passed to APC40Interface::CommitMidiMessages once the buffer was (partially) sent.
+struct APC40MidiFlush
+{
+    size_t size = 0;
+    unsigned int num_messages = 0;
+    unsigned int num_saved_bytes = 0;
+
+    APC40ControlMask dirty{};   // Dirty controls when the flush was prepared
+    APC40ControlMask changes{}; // Dirty controls that differed from the current state
+
+    unsigned char controls[APC40_NUM_CONTROLS];
+    unsigned char values[APC40_NUM_CONTROLS];
+    unsigned short message_ends[APC40_NUM_CONTROLS]; // Buffer offset after each message
+};
+
+// Order of the messages generated by APC40Interface::GetMidiMessages.
+enum class eAPC40MessageOrder
+{
+    Control = 0, // Ascending eAPC40Control order
+    Status       // Grouped by status byte, which maximizes running status
+};
+
+// ------------------------------------------------------------
+
+struct APC40Input
+{
+    eAPC40Control control = eAPC40Control::Invalid;
+    int value = 0;
+    bool pressed = false;
+};
+
+// Input noise filter of a control, see APC40Interface::SetInputFilter. All zero disables filtering.
+struct APC40InputFilter
+{
+    // Sliders and knobs: changes of up to deadband steps from the last passed value are dropped. 0 and 127 always pass.
+    unsigned char deadband = 0;
+
+    // Sliders and knobs: minimum time between two passed messages in ms.
+    // The last throttled value is held and reported by APC40Interface::PollInputFilters once the interval ends, so the final position is never lost.
+    // Neither deadband nor min_interval apply to the relative cue level knob, every tick is real movement.
+    unsigned short min_interval = 0;
+
+    // Buttons and pads: edges within this time after the last passed edge are bounce (in ms).
+    // If the bounce ends in a different state than the last passed edge (ie. the release of a short tap),
+    // that edge is held and reported by APC40Interface::PollInputFilters once the time ends.
+    unsigned short debounce = 0;
+};
+
+// Microseconds of a steady clock, wraps around after about 71 minutes.
+inline uint32_t APC40TimestampMicroseconds()
+{
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Snapshot of the device's input side, see APC40Interface::GetInputState.
+struct APC40InputState
+{
+    // Buttons and pads currently held down.
+    APC40ControlMask pressed;
+
+    // Last value received per control (slider/knob position, note velocity of buttons).
+    unsigned char values[APC40_NUM_CONTROLS]{};
+
+    // Number of presses and releases per button. Comparing two snapshots reveals taps that happened in between.
+    uint32_t edges[APC40_NUM_CONTROLS]{};
+
+    bool IsPressed(eAPC40Control control) const
+    {
+        return control >= eAPC40Control::MinValue && control < eAPC40Control::MaxValue && pressed.Test(static_cast<size_t>(control));
+    }
+
+    // True if any control in mask is held, ie. APC40PadRowMask(y).
+    bool IsAnyPressed(const APC40ControlMask& mask) const
+    {
+        return (pressed & mask).Any();
+    }
+
+    // True if all controls in mask are held (a chord).
+    bool AreAllPressed(const APC40ControlMask& mask) const
+    {
+        return !(mask & ~pressed).Any();
+    }
+};
+
+// ------------------------------------------------------------ 
+
+class APC40Interface
+{
+public:
+
+    APC40Interface()
+    {
+        memset(m_LocalCurrentState, 0, sizeof(m_LocalCurrentState));
+        memset(m_LocalCurrentState, 255, APC40_NUM_CONTROLS);
+        memset(m_LocalDesiredState, 0, sizeof(m_LocalDesiredState));
+
+        m_DirtyMask = APC40_OUTPUT_CONTROL_MASK;
+    }
+
+    ~APC40Interface()
+    {
+
+    }
+
+    // The state may live in external memory (see AttachState), so copying is not supported.
+    APC40Interface(const APC40Interface&) = delete;
+    APC40Interface& operator=(const APC40Interface&) = delete;
+
+    void GetInitMessage(std::vector<unsigned char>& message)
+    {
+        message.assign(APC40_INIT_MESSAGE.begin(), APC40_INIT_MESSAGE.end());
+    }
+
+    static constexpr const std::array<unsigned char, 12>& GetInitMessage()
+    {
+        return APC40_INIT_MESSAGE;
+    }
+
+    // ------------------------------------------------------------ Output
+
+    // Sets the mode of an APC40 control (leds, knob mode, etc).
+    bool SetControlMode(eAPC40Control control, eAPC40LEDMode mode)
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return false;
+
+        SetDesiredState(static_cast<size_t>(control), static_cast<unsigned char>(std::clamp(static_cast<int>(mode), 0, 127)));
+
+        return true;
+    }
+
+    // Sets the mode of an APC40 control (leds, knob mode, etc).
+    bool SetControlMode(eAPC40Control control, eAPC40KnobMode mode)
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return false;
+
+        SetDesiredState(static_cast<size_t>(control), static_cast<unsigned char>(std::clamp(static_cast<int>(mode), 0, 127)));
+
+        return true;
+    }
+
+    // Sets the raw value of an APC40 control (ie knob led count), 0 - 127.
+    bool SetControlValue(eAPC40Control control, int value)
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return false;
+
+        SetDesiredState(static_cast<size_t>(control), static_cast<unsigned char>(std::clamp(value, 0, 127)));
+
+        return true;
+    }
+
+    // ------------------------------------------------------------ Bulk Output
+
+    // The bulk setters validate once per call and copy into the desired state as a whole.
+    // Pad arrays are indexed [y][x], like APC40PackControl lays out the pad.
+
+    void SetPadModes(const eAPC40LEDMode (&modes)[APC40_PAD_SIZE_Y][APC40_PAD_SIZE_X])
+    {
+        unsigned char values[APC40_PAD_SIZE_Y * APC40_PAD_SIZE_X];
+
+        for (int y = 0; y < APC40_PAD_SIZE_Y; ++y)
+        {
+            for (int x = 0; x < APC40_PAD_SIZE_X; ++x)
+                values[y * APC40_PAD_SIZE_X + x] = static_cast<unsigned char>(std::clamp(static_cast<int>(modes[y][x]), 0, 127));
+        }
+
+        SetDesiredStateRange(static_cast<size_t>(eAPC40Control::Pad), values, sizeof(values));
+    }
+
+    // Raw values, 0 - 127.
+    void SetPadValues(const unsigned char (&values)[APC40_PAD_SIZE_Y][APC40_PAD_SIZE_X])
+    {
+        unsigned char clamped[APC40_PAD_SIZE_Y * APC40_PAD_SIZE_X];
+
+        for (int y = 0; y < APC40_PAD_SIZE_Y; ++y)
+        {
+            for (int x = 0; x < APC40_PAD_SIZE_X; ++x)
+                clamped[y * APC40_PAD_SIZE_X + x] = std::min<unsigned char>(values[y][x], 127);
+        }
+
+        SetDesiredStateRange(static_cast<size_t>(eAPC40Control::Pad), clamped, sizeof(clamped));
+    }
+
+    // Fills a rectangle of the pad, clipped to the pad. Returns false if nothing is left after clipping.
+    bool FillPadRect(int x, int y, int width, int height, eAPC40LEDMode mode)
+    {
+        int x0{ std::max(x, 0) };
+        int y0{ std::max(y, 0) };
+        int x1{ std::min(x + width, APC40_PAD_SIZE_X) };
+        int y1{ std::min(y + height, APC40_PAD_SIZE_Y) };
+
+        if (x0 >= x1 || y0 >= y1)
+            return false;
+
+        unsigned char value{ static_cast<unsigned char>(std::clamp(static_cast<int>(mode), 0, 127)) };
+
+        for (int py = y0; py < y1; ++py)
+            FillDesiredStateRange(static_cast<size_t>(APC40PackControl(eAPC40Control::Pad, x0, py)), value, static_cast<size_t>(x1 - x0));
+
+        return true;
+    }
+
+    bool SetPadRow(int y, const eAPC40LEDMode (&modes)[APC40_PAD_SIZE_X])
+    {
+        if (y < 0 || y >= APC40_PAD_SIZE_Y)
+            return false;
+
+        unsigned char values[APC40_PAD_SIZE_X];
+
+        for (int x = 0; x < APC40_PAD_SIZE_X; ++x)
+            values[x] = static_cast<unsigned char>(std::clamp(static_cast<int>(modes[x]), 0, 127));
+
+        SetDesiredStateRange(static_cast<size_t>(APC40PackControl(eAPC40Control::Pad, 0, y)), values, sizeof(values));
+
+        return true;
+    }
+
+    // A column isn't contiguous in the state, so this is the only bulk setter that writes control by control.
+    bool SetPadColumn(int x, const eAPC40LEDMode (&modes)[APC40_PAD_SIZE_Y])
+    {
+        if (x < 0 || x >= APC40_PAD_SIZE_X)
+            return false;
+
+        for (int y = 0; y < APC40_PAD_SIZE_Y; ++y)
+            SetDesiredState(static_cast<size_t>(APC40PackControl(eAPC40Control::Pad, x, y)), static_cast<unsigned char>(std::clamp(static_cast<int>(modes[y]), 0, 127)));
+
+        return true;
+    }
+
+    // Sets the values of the knobs of a group (eAPC40Control::TrackKnobValue or eAPC40Control::DeviceKnobValue), starting at knob 0.
+    // count can be up to APC40_NUM_KNOBS.
+    bool SetKnobValues(eAPC40Control group, const int* values, size_t count)
+    {
+        if ((group != eAPC40Control::TrackKnobValue && group != eAPC40Control::DeviceKnobValue) || count > static_cast<size_t>(APC40_NUM_KNOBS))
+            return false;
+
+        unsigned char clamped[APC40_NUM_KNOBS];
+
+        for (size_t i = 0; i < count; ++i)
+            clamped[i] = static_cast<unsigned char>(std::clamp(values[i], 0, 127));
+
+        SetDesiredStateRange(static_cast<size_t>(group), clamped, count);
+
+        return true;
+    }
+
+    // Sets the mode of all knobs of a group (eAPC40Control::TrackKnobMode or eAPC40Control::DeviceKnobMode).
+    bool SetKnobModes(eAPC40Control group, eAPC40KnobMode mode)
+    {
+        if (group != eAPC40Control::TrackKnobMode && group != eAPC40Control::DeviceKnobMode)
+            return false;
+
+        FillDesiredStateRange(static_cast<size_t>(group), static_cast<unsigned char>(std::clamp(static_cast<int>(mode), 0, 127)), APC40_NUM_KNOBS);
+
+        return true;
+    }
+
+    // Sets the mode of all track and device knobs.
+    void SetKnobModes(eAPC40KnobMode mode)
+    {
+        SetKnobModes(eAPC40Control::TrackKnobMode, mode);
+        SetKnobModes(eAPC40Control::DeviceKnobMode, mode);
+    }
+
+    // Gets the mode of an APC40 control
+    bool GetControlMode(eAPC40Control control, eAPC40LEDMode& mode)
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return false;
+
+        mode = static_cast<eAPC40LEDMode>(GetDesiredState(static_cast<size_t>(control)));
+
+        return true;
+    }
+
+    // Gets the mode of an APC40 control
+    bool GetControlMode(eAPC40Control control, eAPC40KnobMode& mode)
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return false;
+
+        mode = static_cast<eAPC40KnobMode>(GetDesiredState(static_cast<size_t>(control)));
+
+        return true;
+    }
+
+    // Get sthe raw value of an APC40 control
+    bool GetControlValue(eAPC40Control control, int& value)
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return false;
+
+        value = static_cast<int>(GetDesiredState(static_cast<size_t>(control)));
+
+        return true;
+    }
+
+    // Should be called if the APC40 is disconnected.
+    // That way, the library knows to send the midi messages required to restore the state on reconnect.
+    void ResetCurrentState()
+    {
+        memset(m_CurrentState, 255, APC40_NUM_CONTROLS);
+
+        m_DirtyMask = APC40_OUTPUT_CONTROL_MASK;
+    }
+
+    // Can be called instead of ResetCurrentState once the init message (see GetInitMessage) was sent to the device.
+    // The APC40 is in a known state afterwards, so only controls that differ from it are sent on the next update.
+    void MarkDeviceInitialized()
+    {
+        memcpy(m_CurrentState, APC40_INIT_STATE.data(), APC40_NUM_CONTROLS);
+
+        m_DirtyMask = APC40_OUTPUT_CONTROL_MASK;
+    }
+
+    // Records a value that was sent to the device outside of the flush functions (ie. pre-encoded clip midi, see APC40Clip.h).
+    // Sets both the desired and the current state, so the next flush neither resends nor skips the control.
+    // Call this from the thread that flushes, in the default mode (not concurrent or frame mode).
+    bool MarkControlSent(eAPC40Control control, int value)
+    {
+        if (!SetControlValue(control, value))
+            return false;
+
+        m_CurrentState[static_cast<size_t>(control)] = static_cast<unsigned char>(std::clamp(value, 0, 127));
+
+        return true;
+    }
+
+    // Moves the current and desired state into external memory, ie. a memory mapped file (see APC40PersistentState.h).
+    // Both arrays need APC40_STATE_SIZE bytes aligned to APC40_STATE_ALIGNMENT and have to outlive the attachment.
+    // The contents of the external state are used as they are. Pass nullptr to copy the state back into the interface.
+    void AttachState(unsigned char* current_state, unsigned char* desired_state)
+    {
+        if (current_state && desired_state)
+        {
+            m_CurrentState = current_state;
+            m_DesiredState = desired_state;
+        }
+        else if (m_CurrentState != m_LocalCurrentState)
+        {
+            memcpy(m_LocalCurrentState, m_CurrentState, APC40_STATE_SIZE);
+            memcpy(m_LocalDesiredState, m_DesiredState, APC40_STATE_SIZE);
+
+            m_CurrentState = m_LocalCurrentState;
+            m_DesiredState = m_LocalDesiredState;
+        }
+
+        m_DirtyMask = APC40_OUTPUT_CONTROL_MASK;
+    }
+
+    bool IsStateAttached() const
+    {
+        return m_CurrentState != m_LocalCurrentState;
+    }
+
+    // Should be called if you actually want to reset all controls.
+    void ResetDesiredState()
+    {
+        if (m_ConcurrentMode)
+        {
+            for (size_t i = 0; i < APC40_NUM_CONTROLS; ++i)
+                SetDesiredState(i, 0);
+
+            return;
+        }
+
+        memset(m_DesiredState, 0, APC40_NUM_CONTROLS);
+
+        if (!m_FrameMode)
+            m_DirtyMask = APC40_OUTPUT_CONTROL_MASK;
+    }
+
+    // ------------------------------------------------------------ Concurrent Mode
+
+    // Lets any number of threads call the setters (SetControlMode, SetControlValue, ResetDesiredState) while another thread flushes.
+    // Every setter is a relaxed atomic store into a per-control mailbox plus an atomic dirty bit. The flush claims the dirty bits
+    // and copies the claimed values into the desired state. Controls are independent, use frame mode for consistent frames.
+    // Call this before the threads start. Disables frame mode.
+    void SetConcurrentMode(bool enabled)
+    {
+        if (enabled)
+        {
+            m_FrameMode = false;
+
+            for (size_t i = 0; i < APC40_NUM_CONTROLS; ++i)
+                m_Mailbox[i].store(m_DesiredState[i], std::memory_order_relaxed);
+
+            for (size_t w = 0; w < APC40_CONTROL_MASK_WORDS; ++w)
+                m_MailboxDirty[w].store(0, std::memory_order_relaxed);
+        }
+        else if (m_ConcurrentMode)
+        {
+            ClaimMailbox();
+        }
+
+        m_ConcurrentMode = enabled;
+        m_DirtyMask = APC40_OUTPUT_CONTROL_MASK;
+    }
+
+    bool GetConcurrentMode() const
+    {
+        return m_ConcurrentMode;
+    }
+
+    // ------------------------------------------------------------ Frames
+
+    // Enables the front/back buffer model for renderers on a different thread than the flush.
+    // The setters then only write the back buffer (the desired state), which the flush doesn't see until PublishFrame is called.
+    // The flush always works on the last complete published frame, so frames can't tear.
+    // Call this before the render and flush threads start.
+    void SetFrameMode(bool enabled)
+    {
+        if (enabled)
+        {
+            SetConcurrentMode(false);
+
+            for (unsigned char* frame : m_Frames)
+                memcpy(frame, m_DesiredState, APC40_STATE_SIZE);
+
+            m_FrameWriteSlot = 0;
+            m_FrameReadSlot = 1;
+            m_FrameExchange.store(2, std::memory_order_relaxed);
+        }
+
+        m_FrameMode = enabled;
+        m_DirtyMask = APC40_OUTPUT_CONTROL_MASK;
+    }
+
+    bool GetFrameMode() const
+    {
+        return m_FrameMode;
+    }
+
+    // Publishes the desired state as the next frame. Call this from the render thread once a frame is complete.
+    // Lock-free, frames published faster than the flush picks them up replace each other.
+    void PublishFrame()
+    {
+        if (!m_FrameMode)
+            return;
+
+        memcpy(m_Frames[m_FrameWriteSlot], m_DesiredState, APC40_STATE_SIZE);
+
+        m_FrameWriteSlot = m_FrameExchange.exchange(m_FrameWriteSlot | ms_FrameNew, std::memory_order_acq_rel) & ~ms_FrameNew;
+    }
+
+    // Gets the Midi Message queue. Set update_state to false if you don't want to keep this state.
+    // Midi messages are only generated on changed values (current device state vs. desired device state).
+    // Only controls that were set since the last update are compared, so this returns immediately if nothing changed.
+    // If running status is supported by the device (which depends on firmware version), you can save some bandwidth by enabling it.
+    // num_saved_bytes receives the number of status bytes omitted due to running status.
+    void GetMidiMessages(std::vector<unsigned char>& messages, bool update_state, bool running_status, unsigned int* num_messages = nullptr, unsigned int* num_saved_bytes = nullptr)
+    {
+        messages.resize(APC40_MAX_MIDI_BUFFER_SIZE);
+        messages.resize(GetMidiMessages(messages.data(), messages.size(), update_state, running_status, num_messages, num_saved_bytes));
+    }
+
+    // Same as above, but writes into a caller provided buffer and never allocates. Returns the number of bytes written.
+    size_t GetMidiMessages(APC40MidiBuffer& buffer, bool update_state, bool running_status, unsigned int* num_messages = nullptr, unsigned int* num_saved_bytes = nullptr)
+    {
+        return GetMidiMessages(buffer.data(), buffer.size(), update_state, running_status, num_messages, num_saved_bytes);
+    }
+
+    // Same as above. A buffer of APC40_MAX_MIDI_BUFFER_SIZE bytes always fits all messages.
+    // If the buffer is smaller, only complete messages that fit are written. The rest stays pending for the next call.
+    size_t GetMidiMessages(unsigned char* buffer, size_t buffer_size, bool update_state, bool running_status, unsigned int* num_messages = nullptr, unsigned int* num_saved_bytes = nullptr)
+    {
+        APC40MidiFlush flush;
+
+        PrepareMidiMessages(buffer, buffer_size, running_status, flush);
+
+        if (update_state)
+            CommitMidiMessages(flush, flush.size);
+
+        if (num_messages)
+            *num_messages = flush.num_messages;
+
+        if (num_saved_bytes)
+            *num_saved_bytes = flush.num_saved_bytes;
+
+        return flush.size;
+    }
+
+    // Same as GetMidiMessages, but writes at most budget bytes and sends the most important changes first.
+    // Changes are sent lane by lane (see eAPC40OutputLane), whatever doesn't fit stays pending for the next call.
+    // Controls that were left pending by APC40_OUTPUT_MAX_AGE calls are sent before all lanes, so nothing starves.
+    // On a DIN midi link, a budget of APC40_DIN_MIDI_BYTES_PER_SECOND / fps keeps the output latency bounded.
+    size_t GetPrioritizedMidiMessages(unsigned char* buffer, size_t budget, bool update_state, bool running_status, unsigned int* num_messages = nullptr, unsigned int* num_saved_bytes = nullptr)
+    {
+        APC40MidiFlush flush;
+
+        PreparePrioritizedMidiMessages(buffer, budget, running_status, flush);
+
+        if (update_state)
+            CommitMidiMessages(flush, flush.size);
+
+        if (num_messages)
+            *num_messages = flush.num_messages;
+
+        if (num_saved_bytes)
+            *num_saved_bytes = flush.num_saved_bytes;
+
+        return flush.size;
+    }
+
+    size_t GetPrioritizedMidiMessages(APC40MidiBuffer& buffer, size_t budget, bool update_state, bool running_status, unsigned int* num_messages = nullptr, unsigned int* num_saved_bytes = nullptr)
+    {
+        return GetPrioritizedMidiMessages(buffer.data(), std::min(budget, buffer.size()), update_state, running_status, num_messages, num_saved_bytes);
+    }
+
+    // Two-phase version of GetMidiMessages for transports that can fail or send partially (ie. non-blocking writes).
+    // Writes the messages like GetMidiMessages without updating the state and records them in flush.
+    // Once the buffer was sent, call CommitMidiMessages with the number of bytes that actually went out.
+    size_t PrepareMidiMessages(unsigned char* buffer, size_t buffer_size, bool running_status, APC40MidiFlush& flush)
+    {
+        MessageWriter writer{ buffer, buffer_size, running_status, flush };
+
+        BeginFlush(flush);
+
+        if (flush.dirty.Any())
+            WriteMessageGroup(writer, flush.changes);
+
+        return flush.size;
+    }
+
+    // Two-phase version of GetPrioritizedMidiMessages, see PrepareMidiMessages.
+    size_t PreparePrioritizedMidiMessages(unsigned char* buffer, size_t budget, bool running_status, APC40MidiFlush& flush)
+    {
+        MessageWriter writer{ buffer, budget, running_status, flush };
+
+        BeginFlush(flush);
+
+        if (!flush.dirty.Any())
+            return 0;
+
+        APC40ControlMask aged{ flush.changes & m_AgedMask };
+
+        // Aged controls are sent round robin, starting after the last one that was sent
+        APC40ControlMask aged_from_cursor{ APC40ControlMaskFrom(m_AgedCursor) };
+
+        bool fits{ WriteMessageGroup(writer, aged & aged_from_cursor) && WriteMessageGroup(writer, aged & ~aged_from_cursor) };
+
+        for (const APC40ControlMask& lane : APC40_OUTPUT_LANE_MASKS)
+        {
+            if (!fits)
+                break;
+
+            fits = WriteMessageGroup(writer, flush.changes & lane & ~aged);
+        }
+
+        return flush.size;
+    }
+
+    // Marks the controls whose messages lie completely within the first bytes_sent bytes of a prepared flush as sent.
+    // Everything else stays pending, so a retry only costs the messages that were lost. Returns the number of committed messages.
+    // Controls that were changed after PrepareMidiMessages stay pending as well.
+    unsigned int CommitMidiMessages(const APC40MidiFlush& flush, size_t bytes_sent)
+    {
+        unsigned int num_sent{ 0 };
+
+        for (; num_sent < flush.num_messages && flush.message_ends[num_sent] <= bytes_sent; ++num_sent)
+        {
+            size_t i{ flush.controls[num_sent] };
+
+            if (m_AgedMask.Test(i))
+                m_AgedCursor = i + 1;
+
+            m_CurrentState[i] = flush.values[num_sent];
+            m_PendingAge[i] = 0;
+        }
+
+        if (!flush.dirty.Any())
+            return num_sent;
+
+        // Controls that were dirty when the flush was prepared are clean once both states match
+        m_DirtyMask &= ~(flush.dirty & ~APC40DiffStates(m_CurrentState, GetFlushState()));
+
+        m_AgedMask.Clear();
+
+        (flush.changes & m_DirtyMask).ForEach([this](size_t i)
+        {
+            if (m_PendingAge[i] < APC40_OUTPUT_MAX_AGE)
+                ++m_PendingAge[i];
+
+            if (m_PendingAge[i] >= APC40_OUTPUT_MAX_AGE)
+                m_AgedMask.Set(i);
+        });
+
+        return num_sent;
+    }
+
+    // Sets the order of the messages generated by GetMidiMessages.
+    // eAPC40MessageOrder::Status groups messages by midi channel, so running status can omit most status bytes (ie. a full pad redraw shrinks by about 30%).
+    // LEDs are always switched off by note on messages with velocity 0, so they share the status byte as well.
+    void SetMessageOrder(eAPC40MessageOrder order)
+    {
+        m_MessageOrder = order;
+    }
+
+    eAPC40MessageOrder GetMessageOrder() const
+    {
+        return m_MessageOrder;
+    }
+
+    // ------------------------------------------------------------ Message Translation (Midi <-> APC)
+
+    // The translation functions also apply the input filters (see SetInputFilter) and update the input state (see GetInputState).
+    // Filtered messages are rejected like non APC40 messages. Call them from one thread only.
+
+    // midi_message is packed, the status byte is in the lowest 8 bits.
+    bool TranslateInputMessage(unsigned int midi_message, APC40Input& input_message)
+    {
+        if (!DecodeInputMessage(midi_message & 0xFF, (midi_message >> 8) & 0xFF, (midi_message >> 16) & 0xFF, input_message) || !FilterInput(input_message))
+            return false;
+
+        BeginInputStateUpdate();
+        UpdateInputState(input_message);
+        EndInputStateUpdate();
+
+        return true;
+    }
+
+    // midi_message is an array and always expected to be of size 3 or more (any indexes above 2 are ignored).
+    bool TranslateInputMessage(const unsigned char* midi_message, unsigned int midi_message_size, APC40Input& input_message)
+    {
+        if (midi_message_size < 3)
+            return false;
+
+        if (!DecodeInputMessage(midi_message[0], midi_message[1], midi_message[2], input_message) || !FilterInput(input_message))
+            return false;
+
+        BeginInputStateUpdate();
+        UpdateInputState(input_message);
+        EndInputStateUpdate();
+
+        return true;
+    }
+
+    // Translates count packed midi messages (see above) at once, ie. to replay recordings or drain a backlog.
+    // input_messages needs room for count entries. Returns the number of translated messages, which are stored without gaps.
+    // num_rejected receives the number of messages that aren't APC40 input or were filtered.
+    size_t TranslateInputMessages(const unsigned int* midi_messages, size_t count, APC40Input* input_messages, size_t* num_rejected = nullptr)
+    {
+        size_t num_translated{ 0 };
+        size_t i{ 0 };
+
+#if defined APC40_SIMD_AVX2
+        const __m256i status_min{ _mm256_set1_epi32(APC40_INPUT_TABLE_STATUS_MIN) };
+        const __m256i status_range{ _mm256_set1_epi32(APC40_INPUT_TABLE_NUM_STATUS) };
+        const __m256i data_range{ _mm256_set1_epi32(0x80) };
+        const __m256i byte_mask{ _mm256_set1_epi32(0xFF) };
+        const __m256i none{ _mm256_set1_epi32(APC40_INPUT_TABLE_NONE) };
+
+        alignas(32) int controls[8];
+        alignas(32) int values[8];
+        alignas(32) int statuses[8];
+
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i messages{ _mm256_loadu_si256(reinterpret_cast<const __m256i*>(midi_messages + i)) };
+
+            __m256i status{ _mm256_and_si256(messages, byte_mask) };
+            __m256i data1{ _mm256_and_si256(_mm256_srli_epi32(messages, 8), byte_mask) };
+            __m256i data2{ _mm256_and_si256(_mm256_srli_epi32(messages, 16), byte_mask) };
+
+            // Messages outside of the table are looked up at index 0 and discarded afterwards
+            __m256i status_offset{ _mm256_sub_epi32(status, status_min) };
+            __m256i valid{ _mm256_and_si256(_mm256_cmpgt_epi32(status_range, status_offset), _mm256_cmpgt_epi32(status_offset, _mm256_set1_epi32(-1))) };
+            valid = _mm256_and_si256(valid, _mm256_cmpgt_epi32(data_range, data1));
+
+            __m256i index{ _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi32(status_offset, 7), data1), valid) };
+            __m256i control{ _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(ms_ControlInputTable.data()), index, 1), byte_mask) };
+
+            control = _mm256_blendv_epi8(none, control, valid);
+
+            _mm256_store_si256(reinterpret_cast<__m256i*>(controls), control);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(values), _mm256_min_epi32(data2, _mm256_set1_epi32(127)));
+            _mm256_store_si256(reinterpret_cast<__m256i*>(statuses), status);
+
+            // One input state update per block, so readers aren't locked out for the whole batch
+            BeginInputStateUpdate();
+
+            for (int k = 0; k < 8; ++k)
+            {
+                APC40Input& input_message{ input_messages[num_translated] };
+
+                input_message.control = static_cast<eAPC40Control>(controls[k]);
+                input_message.value = values[k];
+                input_message.pressed = (statuses[k] & 0xF0) != 0x80;
+
+                if (controls[k] != APC40_INPUT_TABLE_NONE && FilterInput(input_message))
+                {
+                    UpdateInputState(input_message);
+                    ++num_translated;
+                }
+            }
+
+            EndInputStateUpdate();
+        }
+#endif
+
+        for (; i < count; ++i)
+        {
+            unsigned int midi_message{ midi_messages[i] };
+
+            if (TranslateInputMessage(midi_message, input_messages[num_translated]))
+                ++num_translated;
+        }
+
+        if (num_rejected)
+            *num_rejected = count - num_translated;
+
+        return num_translated;
+    }
+
+    // Same as above, midi_messages holds count raw messages of 3 bytes each.
+    size_t TranslateInputMessages(const unsigned char* midi_messages, size_t count, APC40Input* input_messages, size_t* num_rejected = nullptr)
+    {
+        size_t num_translated{ 0 };
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (TranslateInputMessage(midi_messages + i * 3, 3, input_messages[num_translated]))
+                ++num_translated;
+        }
+
+        if (num_rejected)
+            *num_rejected = count - num_translated;
+
+        return num_translated;
+    }
+
+    bool TranslateOutputMessage(eAPC40Control control, int value, unsigned char& b1, unsigned char& b2, unsigned char& b3)
+    {
+        return APC40TranslateOutputMessage(control, value, b1, b2, b3);
+    }
+
+    // ------------------------------------------------------------ Input State
+
+    // Copies a consistent snapshot of the input state. Safe to call from any thread.
+    void GetInputState(APC40InputState& state) const
+    {
+        for (;;)
+        {
+            uint32_t sequence{ m_InputSequence.load(std::memory_order_acquire) };
+
+            if (sequence & 1)
+                continue;
+
+            for (size_t w = 0; w < APC40_CONTROL_MASK_WORDS; ++w)
+                state.pressed.words[w] = m_InputPressed[w].load(std::memory_order_relaxed);
+
+            for (size_t i = 0; i < APC40_NUM_CONTROLS; ++i)
+            {
+                state.values[i] = m_InputValues[i].load(std::memory_order_relaxed);
+                state.edges[i] = m_InputEdges[i].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (m_InputSequence.load(std::memory_order_relaxed) == sequence)
+                return;
+        }
+    }
+
+    // Buttons and pads currently held down. Cheaper than a full snapshot, safe to call from any thread.
+    APC40ControlMask GetPressedInputs() const
+    {
+        APC40ControlMask pressed;
+
+        for (;;)
+        {
+            uint32_t sequence{ m_InputSequence.load(std::memory_order_acquire) };
+
+            if (sequence & 1)
+                continue;
+
+            for (size_t w = 0; w < APC40_CONTROL_MASK_WORDS; ++w)
+                pressed.words[w] = m_InputPressed[w].load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (m_InputSequence.load(std::memory_order_relaxed) == sequence)
+                return pressed;
+        }
+    }
+
+    bool IsInputPressed(eAPC40Control control) const
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return false;
+
+        size_t i{ static_cast<size_t>(control) };
+
+        return (m_InputPressed[i >> 6].load(std::memory_order_relaxed) >> (i & 63)) & 1;
+    }
+
+    // Last value received for a control, 0 if none was received yet.
+    int GetInputValue(eAPC40Control control) const
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return 0;
+
+        return m_InputValues[static_cast<size_t>(control)].load(std::memory_order_relaxed);
+    }
+
+    // Forgets all held buttons, values and edge counts, ie. after the device was reconnected.
+    // Call this from the thread that translates input.
+    void ResetInputState()
+    {
+        BeginInputStateUpdate();
+
+        for (size_t w = 0; w < APC40_CONTROL_MASK_WORDS; ++w)
+            m_InputPressed[w].store(0, std::memory_order_relaxed);
+
+        for (size_t i = 0; i < APC40_NUM_CONTROLS; ++i)
+        {
+            m_InputValues[i].store(0, std::memory_order_relaxed);
+            m_InputEdges[i].store(0, std::memory_order_relaxed);
+        }
+
+        EndInputStateUpdate();
+    }
+
+    // ------------------------------------------------------------ Input Filters
+
+    // Sets the noise filter of a control. Call this from the thread that translates input.
+    bool SetInputFilter(eAPC40Control control, const APC40InputFilter& filter)
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return false;
+
+        APC40ControlMask mask{};
+        mask.Set(static_cast<size_t>(control));
+
+        SetInputFilter(mask, filter);
+
+        return true;
+    }
+
+    // Sets the noise filter of all controls in mask, ie. APC40ControlGroupMask(eAPC40Control::VolumeSlider).
+    void SetInputFilter(const APC40ControlMask& mask, const APC40InputFilter& filter)
+    {
+        (mask & ~APC40ControlMaskFrom(APC40_NUM_CONTROLS)).ForEach([&](size_t i)
+        {
+            bool button{ APC40_BUTTON_INPUT_MASK.Test(i) };
+            bool relative{ i == static_cast<size_t>(eAPC40Control::CueLevelKnob) };
+            bool timed{ button ? filter.debounce != 0 : !relative && filter.min_interval != 0 };
+
+            m_InputFilters[i] = filter;
+            m_InputFilterPassed.Reset(i);
+            m_InputFilterPending.Reset(i);
+
+            if (timed || (!button && !relative && filter.deadband != 0))
+                m_InputFilterMask.Set(i);
+            else
+                m_InputFilterMask.Reset(i);
+
+            if (timed)
+                m_InputFilterTimedMask.Set(i);
+            else
+                m_InputFilterTimedMask.Reset(i);
+        });
+    }
+
+    bool GetInputFilter(eAPC40Control control, APC40InputFilter& filter) const
+    {
+        if (control < eAPC40Control::MinValue || control >= eAPC40Control::MaxValue)
+            return false;
+
+        filter = m_InputFilters[static_cast<size_t>(control)];
+
+        return true;
+    }
+
+    void ClearInputFilters()
+    {
+        SetInputFilter(~APC40ControlMask{}, APC40InputFilter{});
+    }
+
+    // Reports the messages the filters held back whose debounce time or min_interval has ended:
+    // the final edge of a bounce (ie. the release of a short tap) and the last value of a throttled slider or knob.
+    // They update the input state like translated messages. Call this regularly (ie. once per frame) from the thread that translates input.
+    // Returns the number of messages written to input_messages.
+    size_t PollInputFilters(APC40Input* input_messages, size_t max_messages)
+    {
+        if (!m_InputFilterPending.Any())
+            return 0;
+
+        uint32_t time{ APC40TimestampMicroseconds() };
+        size_t count{ 0 };
+
+        APC40ControlMask pending{ m_InputFilterPending };
+
+        pending.ForEach([&](size_t i)
+        {
+            const APC40InputFilter& filter{ m_InputFilters[i] };
+            unsigned int window{ (APC40_BUTTON_INPUT_MASK.Test(i) ? filter.debounce : filter.min_interval) * 1000u };
+
+            if (count >= max_messages || time - m_InputFilterTimes[i] < window)
+                return;
+
+            APC40Input& input_message{ input_messages[count++] };
+
+            input_message.control = static_cast<eAPC40Control>(i);
+            input_message.value = m_InputFilterPendingValues[i];
+            input_message.pressed = m_InputFilterPendingPressed.Test(i);
+
+            PassInput(input_message, time);
+
+            BeginInputStateUpdate();
+            UpdateInputState(input_message);
+            EndInputStateUpdate();
+        });
+
+        return count;
+    }
+
+    // ------------------------------------------------------------ Utility
+
+    // Gets an x, y coord for a position on the pad's circumference (0-31) - scene launch excluded
+    bool GetPadCircularPos(int pos, int& x, int& y)
+    {
+        if (pos < 0 || pos >= 32)
+            return false;
+
+        if (pos >= 0 && pos <= 7) // Horizontal Top
+        {
+            x = pos;
+            y = 0;
+        }
+        else if (pos >= 16 && pos <= 23) // Horizontal Bottom
+        {
+            x = 7 - (pos - 16);
+            y = 9;
+        }
+        else if (pos >= 7 && pos <= 16) // Vertical Right
+        {
+            x = 7;
+            y = pos - 7;
+        }
+        else if (pos >= 23 && pos <= 31) // Vertical Left
+        {
+            x = 0;
+            y = 9 - (pos - 23);
+        }
+
+        return true;
+    }
+
+    bool IsValidPadPos(int x, int y, bool allow_scene = true)
+    {
+        if (allow_scene && x == 8 && y >= 0 && y < 7)
+            return true;
+
+        if (x < 0 || x > 7 || y < 0 || y > 9)
+            return false;
+
+        return true;
+    }
+
+    int GetKnobValueLEDCount(unsigned char value, eAPC40KnobMode mode)
+    {
+        switch (mode)
+        {
+        case eAPC40KnobMode::Single:
+            if (value < 1) return 0;
+            if (value < 10) return 1;
+            if (value < 19) return 2;
+            if (value < 28) return 3;
+            if (value < 37) return 4;
+            if (value < 46) return 5;
+            if (value < 55) return 6;
+            if (value < 64) return 7;
+            if (value < 72) return 8;
+            if (value < 81) return 9;
+            if (value < 90) return 10;
+            if (value < 99) return 11;
+            if (value < 108) return 12;
             if (value < 117) return 13;
             if (value < 127) return 14;
             return 15;
@@ -592,394 +1845,387 @@ public:
 
 private:
 
-    unsigned char m_CurrentState[static_cast<size_t>(eAPC40Control::MaxValue)];
-    unsigned char m_DesiredState[static_cast<size_t>(eAPC40Control::MaxValue)];
-
-    inline static std::map<std::pair<int, int>, int> ms_ControlInputMap = // TODO: Change the value (int) to eAPC40Control and make it readable
-    {
-        { std::make_pair(0x80, 0x30), 81 },
-        { std::make_pair(0x80, 0x31), 72 },
-        { std::make_pair(0x80, 0x32), 63 },
-        { std::make_pair(0x80, 0x33), 54 },
-        { std::make_pair(0x80, 0x34), 45 },
-        { std::make_pair(0x80, 0x35), 0 },
-        { std::make_pair(0x80, 0x36), 9 },
-        { std::make_pair(0x80, 0x37), 18 },
-        { std::make_pair(0x80, 0x38), 27 },
-        { std::make_pair(0x80, 0x39), 36 },
-        { std::make_pair(0x80, 0x3A), 102 },
-        { std::make_pair(0x80, 0x3B), 103 },
-        { std::make_pair(0x80, 0x3C), 104 },
-        { std::make_pair(0x80, 0x3D), 105 },
-        { std::make_pair(0x80, 0x3E), 106 },
-        { std::make_pair(0x80, 0x3F), 107 },
-        { std::make_pair(0x80, 0x40), 108 },
-        { std::make_pair(0x80, 0x41), 109 },
-        { std::make_pair(0x80, 0x50), 62 },
-        { std::make_pair(0x80, 0x51), 53 },
-        { std::make_pair(0x80, 0x52), 8 },
-        { std::make_pair(0x80, 0x53), 17 },
-        { std::make_pair(0x80, 0x54), 26 },
-        { std::make_pair(0x80, 0x55), 35 },
-        { std::make_pair(0x80, 0x56), 44 },
-        { std::make_pair(0x80, 0x57), 90 },
-        { std::make_pair(0x80, 0x58), 91 },
-        { std::make_pair(0x80, 0x59), 92 },
-        { std::make_pair(0x80, 0x5A), 93 },
-        { std::make_pair(0x80, 0x5B), 110 },
-        { std::make_pair(0x80, 0x5C), 111 },
-        { std::make_pair(0x80, 0x5D), 112 },
-        { std::make_pair(0x80, 0x5E), 95 },
-        { std::make_pair(0x80, 0x5F), 96 },
-        { std::make_pair(0x80, 0x60), 98 },
-        { std::make_pair(0x80, 0x61), 97 },
-        { std::make_pair(0x80, 0x62), 94 },
-        { std::make_pair(0x80, 0x63), 99 },
-        { std::make_pair(0x80, 0x64), 101 },
-        { std::make_pair(0x80, 0x65), 100 },
-        { std::make_pair(0x81, 0x30), 82 },
-        { std::make_pair(0x81, 0x31), 73 },
-        { std::make_pair(0x81, 0x32), 64 },
-        { std::make_pair(0x81, 0x33), 55 },
-        { std::make_pair(0x81, 0x34), 46 },
-        { std::make_pair(0x81, 0x35), 1 },
-        { std::make_pair(0x81, 0x36), 10 },
-        { std::make_pair(0x81, 0x37), 19 },
-        { std::make_pair(0x81, 0x38), 28 },
-        { std::make_pair(0x81, 0x39), 37 },
-        { std::make_pair(0x82, 0x30), 83 },
-        { std::make_pair(0x82, 0x31), 74 },
-        { std::make_pair(0x82, 0x32), 65 },
-        { std::make_pair(0x82, 0x33), 56 },
-        { std::make_pair(0x82, 0x34), 47 },
-        { std::make_pair(0x82, 0x35), 2 },
-        { std::make_pair(0x82, 0x36), 11 },
-        { std::make_pair(0x82, 0x37), 20 },
-        { std::make_pair(0x82, 0x38), 29 },
-        { std::make_pair(0x82, 0x39), 38 },
-        { std::make_pair(0x83, 0x30), 84 },
-        { std::make_pair(0x83, 0x31), 75 },
-        { std::make_pair(0x83, 0x32), 66 },
-        { std::make_pair(0x83, 0x33), 57 },
-        { std::make_pair(0x83, 0x34), 48 },
-        { std::make_pair(0x83, 0x35), 3 },
-        { std::make_pair(0x83, 0x36), 12 },
-        { std::make_pair(0x83, 0x37), 21 },
-        { std::make_pair(0x83, 0x38), 30 },
-        { std::make_pair(0x83, 0x39), 39 },
-        { std::make_pair(0x84, 0x30), 85 },
-        { std::make_pair(0x84, 0x31), 76 },
-        { std::make_pair(0x84, 0x32), 67 },
-        { std::make_pair(0x84, 0x33), 58 },
-        { std::make_pair(0x84, 0x34), 49 },
-        { std::make_pair(0x84, 0x35), 4 },
-        { std::make_pair(0x84, 0x36), 13 },
-        { std::make_pair(0x84, 0x37), 22 },
-        { std::make_pair(0x84, 0x38), 31 },
-        { std::make_pair(0x84, 0x39), 40 },
-        { std::make_pair(0x85, 0x30), 86 },
-        { std::make_pair(0x85, 0x31), 77 },
-        { std::make_pair(0x85, 0x32), 68 },
-        { std::make_pair(0x85, 0x33), 59 },
-        { std::make_pair(0x85, 0x34), 50 },
-        { std::make_pair(0x85, 0x35), 5 },
-        { std::make_pair(0x85, 0x36), 14 },
-        { std::make_pair(0x85, 0x37), 23 },
-        { std::make_pair(0x85, 0x38), 32 },
-        { std::make_pair(0x85, 0x39), 41 },
-        { std::make_pair(0x86, 0x30), 87 },
-        { std::make_pair(0x86, 0x31), 78 },
-        { std::make_pair(0x86, 0x32), 69 },
-        { std::make_pair(0x86, 0x33), 60 },
-        { std::make_pair(0x86, 0x34), 51 },
-        { std::make_pair(0x86, 0x35), 6 },
-        { std::make_pair(0x86, 0x36), 15 },
-        { std::make_pair(0x86, 0x37), 24 },
-        { std::make_pair(0x86, 0x38), 33 },
-        { std::make_pair(0x86, 0x39), 42 },
-        { std::make_pair(0x87, 0x30), 88 },
-        { std::make_pair(0x87, 0x31), 79 },
-        { std::make_pair(0x87, 0x32), 70 },
-        { std::make_pair(0x87, 0x33), 61 },
-        { std::make_pair(0x87, 0x34), 52 },
-        { std::make_pair(0x87, 0x35), 7 },
-        { std::make_pair(0x87, 0x36), 16 },
-        { std::make_pair(0x87, 0x37), 25 },
-        { std::make_pair(0x87, 0x38), 34 },
-        { std::make_pair(0x87, 0x39), 43 },
-        { std::make_pair(0x90, 0x30), 81 },
-        { std::make_pair(0x90, 0x31), 72 },
-        { std::make_pair(0x90, 0x32), 63 },
-        { std::make_pair(0x90, 0x33), 54 },
-        { std::make_pair(0x90, 0x34), 45 },
-        { std::make_pair(0x90, 0x35), 0 },
-        { std::make_pair(0x90, 0x36), 9 },
-        { std::make_pair(0x90, 0x37), 18 },
-        { std::make_pair(0x90, 0x38), 27 },
-        { std::make_pair(0x90, 0x39), 36 },
-        { std::make_pair(0x90, 0x3A), 102 },
-        { std::make_pair(0x90, 0x3B), 103 },
-        { std::make_pair(0x90, 0x3C), 104 },
-        { std::make_pair(0x90, 0x3D), 105 },
-        { std::make_pair(0x90, 0x3E), 106 },
-        { std::make_pair(0x90, 0x3F), 107 },
-        { std::make_pair(0x90, 0x40), 108 },
-        { std::make_pair(0x90, 0x41), 109 },
-        { std::make_pair(0x90, 0x50), 62 },
-        { std::make_pair(0x90, 0x51), 53 },
-        { std::make_pair(0x90, 0x52), 8 },
-        { std::make_pair(0x90, 0x53), 17 },
-        { std::make_pair(0x90, 0x54), 26 },
-        { std::make_pair(0x90, 0x55), 35 },
-        { std::make_pair(0x90, 0x56), 44 },
-        { std::make_pair(0x90, 0x57), 90 },
-        { std::make_pair(0x90, 0x58), 91 },
-        { std::make_pair(0x90, 0x59), 92 },
-        { std::make_pair(0x90, 0x5A), 93 },
-        { std::make_pair(0x90, 0x5B), 110 },
-        { std::make_pair(0x90, 0x5C), 111 },
-        { std::make_pair(0x90, 0x5D), 112 },
-        { std::make_pair(0x90, 0x5E), 95 },
-        { std::make_pair(0x90, 0x5F), 96 },
-        { std::make_pair(0x90, 0x60), 98 },
-        { std::make_pair(0x90, 0x61), 97 },
-        { std::make_pair(0x90, 0x62), 94 },
-        { std::make_pair(0x90, 0x63), 99 },
-        { std::make_pair(0x90, 0x64), 101 },
-        { std::make_pair(0x90, 0x65), 100 },
-        { std::make_pair(0x91, 0x30), 82 },
-        { std::make_pair(0x91, 0x31), 73 },
-        { std::make_pair(0x91, 0x32), 64 },
-        { std::make_pair(0x91, 0x33), 55 },
-        { std::make_pair(0x91, 0x34), 46 },
-        { std::make_pair(0x91, 0x35), 1 },
-        { std::make_pair(0x91, 0x36), 10 },
-        { std::make_pair(0x91, 0x37), 19 },
-        { std::make_pair(0x91, 0x38), 28 },
-        { std::make_pair(0x91, 0x39), 37 },
-        { std::make_pair(0x92, 0x30), 83 },
-        { std::make_pair(0x92, 0x31), 74 },
-        { std::make_pair(0x92, 0x32), 65 },
-        { std::make_pair(0x92, 0x33), 56 },
-        { std::make_pair(0x92, 0x34), 47 },
-        { std::make_pair(0x92, 0x35), 2 },
-        { std::make_pair(0x92, 0x36), 11 },
-        { std::make_pair(0x92, 0x37), 20 },
-        { std::make_pair(0x92, 0x38), 29 },
-        { std::make_pair(0x92, 0x39), 38 },
-        { std::make_pair(0x93, 0x30), 84 },
-        { std::make_pair(0x93, 0x31), 75 },
-        { std::make_pair(0x93, 0x32), 66 },
-        { std::make_pair(0x93, 0x33), 57 },
-        { std::make_pair(0x93, 0x34), 48 },
-        { std::make_pair(0x93, 0x35), 3 },
-        { std::make_pair(0x93, 0x36), 12 },
-        { std::make_pair(0x93, 0x37), 21 },
-        { std::make_pair(0x93, 0x38), 30 },
-        { std::make_pair(0x93, 0x39), 39 },
-        { std::make_pair(0x94, 0x30), 85 },
-        { std::make_pair(0x94, 0x31), 76 },
-        { std::make_pair(0x94, 0x32), 67 },
-        { std::make_pair(0x94, 0x33), 58 },
-        { std::make_pair(0x94, 0x34), 49 },
-        { std::make_pair(0x94, 0x35), 4 },
-        { std::make_pair(0x94, 0x36), 13 },
-        { std::make_pair(0x94, 0x37), 22 },
-        { std::make_pair(0x94, 0x38), 31 },
-        { std::make_pair(0x94, 0x39), 40 },
-        { std::make_pair(0x95, 0x30), 86 },
-        { std::make_pair(0x95, 0x31), 77 },
-        { std::make_pair(0x95, 0x32), 68 },
-        { std::make_pair(0x95, 0x33), 59 },
-        { std::make_pair(0x95, 0x34), 50 },
-        { std::make_pair(0x95, 0x35), 5 },
-        { std::make_pair(0x95, 0x36), 14 },
-        { std::make_pair(0x95, 0x37), 23 },
-        { std::make_pair(0x95, 0x38), 32 },
-        { std::make_pair(0x95, 0x39), 41 },
-        { std::make_pair(0x96, 0x30), 87 },
-        { std::make_pair(0x96, 0x31), 78 },
-        { std::make_pair(0x96, 0x32), 69 },
-        { std::make_pair(0x96, 0x33), 60 },
-        { std::make_pair(0x96, 0x34), 51 },
-        { std::make_pair(0x96, 0x35), 6 },
-        { std::make_pair(0x96, 0x36), 15 },
-        { std::make_pair(0x96, 0x37), 24 },
-        { std::make_pair(0x96, 0x38), 33 },
-        { std::make_pair(0x96, 0x39), 42 },
-        { std::make_pair(0x97, 0x30), 88 },
-        { std::make_pair(0x97, 0x31), 79 },
-        { std::make_pair(0x97, 0x32), 70 },
-        { std::make_pair(0x97, 0x33), 61 },
-        { std::make_pair(0x97, 0x34), 52 },
-        { std::make_pair(0x97, 0x35), 7 },
-        { std::make_pair(0x97, 0x36), 16 },
-        { std::make_pair(0x97, 0x37), 25 },
-        { std::make_pair(0x97, 0x38), 34 },
-        { std::make_pair(0x97, 0x39), 43 },
-        { std::make_pair(0xB0, 0x07), 113 },
-        { std::make_pair(0xB0, 0x0E), 121 },
-        { std::make_pair(0xB0, 0x0F), 122 },
-        { std::make_pair(0xB0, 0x10), 148 },
-        { std::make_pair(0xB0, 0x11), 149 },
-        { std::make_pair(0xB0, 0x12), 150 },
-        { std::make_pair(0xB0, 0x13), 151 },
-        { std::make_pair(0xB0, 0x14), 152 },
-        { std::make_pair(0xB0, 0x15), 153 },
-        { std::make_pair(0xB0, 0x16), 154 },
-        { std::make_pair(0xB0, 0x17), 155 },
-        { std::make_pair(0xB0, 0x2F), 123 },
-        { std::make_pair(0xB0, 0x30), 132 },
-        { std::make_pair(0xB0, 0x31), 133 },
-        { std::make_pair(0xB0, 0x32), 134 },
-        { std::make_pair(0xB0, 0x33), 135 },
-        { std::make_pair(0xB0, 0x34), 136 },
-        { std::make_pair(0xB0, 0x35), 137 },
-        { std::make_pair(0xB0, 0x36), 138 },
-        { std::make_pair(0xB0, 0x37), 139 },
-        { std::make_pair(0xB1, 0x07), 114 },
-        { std::make_pair(0xB2, 0x07), 115 },
-        { std::make_pair(0xB3, 0x07), 116 },
-        { std::make_pair(0xB4, 0x07), 117 },
-        { std::make_pair(0xB5, 0x07), 118 },
-        { std::make_pair(0xB6, 0x07), 119 },
-        { std::make_pair(0xB7, 0x07), 120 },
-    };
+    bool DecodeInputMessage(unsigned int b1, unsigned int b2, unsigned int b3, APC40Input& input_message) const
+    {
+        if (b1 < APC40_INPUT_TABLE_STATUS_MIN || b1 >= APC40_INPUT_TABLE_STATUS_MIN + APC40_INPUT_TABLE_NUM_STATUS || b2 > 0x7F)
+            return false;
+
+        unsigned char control{ ms_ControlInputTable[APC40InputTableIndex(b1, b2)] };
+
+        if (control == APC40_INPUT_TABLE_NONE)
+            return false;
+
+        input_message.control = static_cast<eAPC40Control>(control);
+        input_message.value = static_cast<int>(std::min(b3, 127u));
+        input_message.pressed = (b1 & 0xF0) != 0x80;
+
+        return true;
+    }
+
+    // Returns false if the message is noise according to the control's filter.
+    bool FilterInput(const APC40Input& input_message)
+    {
+        size_t i{ static_cast<size_t>(input_message.control) };
+
+        if (!m_InputFilterMask.Test(i))
+            return true;
+
+        const APC40InputFilter& filter{ m_InputFilters[i] };
+
+        // Only controls with a time based filter read the clock
+        uint32_t time{ m_InputFilterTimedMask.Test(i) ? APC40TimestampMicroseconds() : 0 };
+        uint32_t elapsed{ time - m_InputFilterTimes[i] };
+
+        if (m_InputFilterPassed.Test(i))
+        {
+            if (APC40_BUTTON_INPUT_MASK.Test(i))
+            {
+                if (elapsed < filter.debounce * 1000u)
+                {
+                    // Bounce: an edge back to the passed state cancels the held one, the other is held until the window ends
+                    if (input_message.pressed == m_InputFilterPressed.Test(i))
+                        m_InputFilterPending.Reset(i);
+                    else
+                        HoldInput(input_message);
+
+                    return false;
+                }
+            }
+            else
+            {
+                int value{ input_message.value };
+                int last_value{ m_InputFilterValues[i] };
+
+                bool endpoint{ (value == 0 || value == 127) && value != last_value };
+
+                if (!endpoint)
+                {
+                    // Back within the deadband of the passed value, nothing left to report
+                    if (filter.deadband != 0 && std::abs(value - last_value) <= filter.deadband)
+                    {
+                        m_InputFilterPending.Reset(i);
+                        return false;
+                    }
+
+                    // Throttled, the last throttled value is reported once the interval ends
+                    if (elapsed < filter.min_interval * 1000u)
+                    {
+                        HoldInput(input_message);
+                        return false;
+                    }
+                }
+            }
+        }
+
+        PassInput(input_message, time);
+
+        return true;
+    }
+
+    // Keeps a filtered message to be reported by PollInputFilters, replacing an older one of the same control.
+    void HoldInput(const APC40Input& input_message)
+    {
+        size_t i{ static_cast<size_t>(input_message.control) };
+
+        m_InputFilterPendingValues[i] = static_cast<unsigned char>(input_message.value);
+        m_InputFilterPending.Set(i);
+
+        if (input_message.pressed)
+            m_InputFilterPendingPressed.Set(i);
+        else
+            m_InputFilterPendingPressed.Reset(i);
+    }
+
+    // Records a message that passed the filter.
+    void PassInput(const APC40Input& input_message, uint32_t time)
+    {
+        size_t i{ static_cast<size_t>(input_message.control) };
+
+        m_InputFilterValues[i] = static_cast<unsigned char>(input_message.value);
+        m_InputFilterTimes[i] = time;
+        m_InputFilterPassed.Set(i);
+        m_InputFilterPending.Reset(i);
+
+        if (input_message.pressed)
+            m_InputFilterPressed.Set(i);
+        else
+            m_InputFilterPressed.Reset(i);
+    }
+
+    // Input state updates are wrapped in a seqlock, so readers on other threads can detect torn snapshots.
+    void BeginInputStateUpdate()
+    {
+        m_InputSequence.store(m_InputSequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void EndInputStateUpdate()
+    {
+        m_InputSequence.store(m_InputSequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    void UpdateInputState(const APC40Input& input_message)
+    {
+        size_t i{ static_cast<size_t>(input_message.control) };
+
+        m_InputValues[i].store(static_cast<unsigned char>(input_message.value), std::memory_order_relaxed);
 
-    inline static std::map<int, std::pair<int, int>> ms_ControlOutputMap = // TODO: Change the key (int) to eAPC40Control and make it readable
-    {
-        { 0, std::make_pair(0x90, 0x35) },
-        { 1, std::make_pair(0x91, 0x35) },
-        { 2, std::make_pair(0x92, 0x35) },
-        { 3, std::make_pair(0x93, 0x35) },
-        { 4, std::make_pair(0x94, 0x35) },
-        { 5, std::make_pair(0x95, 0x35) },
-        { 6, std::make_pair(0x96, 0x35) },
-        { 7, std::make_pair(0x97, 0x35) },
-        { 8, std::make_pair(0x90, 0x52) },
-        { 9, std::make_pair(0x90, 0x36) },
-        { 10, std::make_pair(0x91, 0x36) },
-        { 11, std::make_pair(0x92, 0x36) },
-        { 12, std::make_pair(0x93, 0x36) },
-        { 13, std::make_pair(0x94, 0x36) },
-        { 14, std::make_pair(0x95, 0x36) },
-        { 15, std::make_pair(0x96, 0x36) },
-        { 16, std::make_pair(0x97, 0x36) },
-        { 17, std::make_pair(0x90, 0x53) },
-        { 18, std::make_pair(0x90, 0x37) },
-        { 19, std::make_pair(0x91, 0x37) },
-        { 20, std::make_pair(0x92, 0x37) },
-        { 21, std::make_pair(0x93, 0x37) },
-        { 22, std::make_pair(0x94, 0x37) },
-        { 23, std::make_pair(0x95, 0x37) },
-        { 24, std::make_pair(0x96, 0x37) },
-        { 25, std::make_pair(0x97, 0x37) },
-        { 26, std::make_pair(0x90, 0x54) },
-        { 27, std::make_pair(0x90, 0x38) },
-        { 28, std::make_pair(0x91, 0x38) },
-        { 29, std::make_pair(0x92, 0x38) },
-        { 30, std::make_pair(0x93, 0x38) },
-        { 31, std::make_pair(0x94, 0x38) },
-        { 32, std::make_pair(0x95, 0x38) },
-        { 33, std::make_pair(0x96, 0x38) },
-        { 34, std::make_pair(0x97, 0x38) },
-        { 35, std::make_pair(0x90, 0x55) },
-        { 36, std::make_pair(0x90, 0x39) },
-        { 37, std::make_pair(0x91, 0x39) },
-        { 38, std::make_pair(0x92, 0x39) },
-        { 39, std::make_pair(0x93, 0x39) },
-        { 40, std::make_pair(0x94, 0x39) },
-        { 41, std::make_pair(0x95, 0x39) },
-        { 42, std::make_pair(0x96, 0x39) },
-        { 43, std::make_pair(0x97, 0x39) },
-        { 44, std::make_pair(0x90, 0x56) },
-        { 45, std::make_pair(0x90, 0x34) },
-        { 46, std::make_pair(0x91, 0x34) },
-        { 47, std::make_pair(0x92, 0x34) },
-        { 48, std::make_pair(0x93, 0x34) },
-        { 49, std::make_pair(0x94, 0x34) },
-        { 50, std::make_pair(0x95, 0x34) },
-        { 51, std::make_pair(0x96, 0x34) },
-        { 52, std::make_pair(0x97, 0x34) },
-        { 53, std::make_pair(0x90, 0x51) },
-        { 54, std::make_pair(0x90, 0x33) },
-        { 55, std::make_pair(0x91, 0x33) },
-        { 56, std::make_pair(0x92, 0x33) },
-        { 57, std::make_pair(0x93, 0x33) },
-        { 58, std::make_pair(0x94, 0x33) },
-        { 59, std::make_pair(0x95, 0x33) },
-        { 60, std::make_pair(0x96, 0x33) },
-        { 61, std::make_pair(0x97, 0x33) },
-        { 62, std::make_pair(0x90, 0x50) },
-        { 63, std::make_pair(0x90, 0x32) },
-        { 64, std::make_pair(0x91, 0x32) },
-        { 65, std::make_pair(0x92, 0x32) },
-        { 66, std::make_pair(0x93, 0x32) },
-        { 67, std::make_pair(0x94, 0x32) },
-        { 68, std::make_pair(0x95, 0x32) },
-        { 69, std::make_pair(0x96, 0x32) },
-        { 70, std::make_pair(0x97, 0x32) },
-        { 72, std::make_pair(0x90, 0x31) },
-        { 73, std::make_pair(0x91, 0x31) },
-        { 74, std::make_pair(0x92, 0x31) },
-        { 75, std::make_pair(0x93, 0x31) },
-        { 76, std::make_pair(0x94, 0x31) },
-        { 77, std::make_pair(0x95, 0x31) },
-        { 78, std::make_pair(0x96, 0x31) },
-        { 79, std::make_pair(0x97, 0x31) },
-        { 81, std::make_pair(0x90, 0x30) },
-        { 82, std::make_pair(0x91, 0x30) },
-        { 83, std::make_pair(0x92, 0x30) },
-        { 84, std::make_pair(0x93, 0x30) },
-        { 85, std::make_pair(0x94, 0x30) },
-        { 86, std::make_pair(0x95, 0x30) },
-        { 87, std::make_pair(0x96, 0x30) },
-        { 88, std::make_pair(0x97, 0x30) },
-        { 90, std::make_pair(0x90, 0x57) },
-        { 91, std::make_pair(0x90, 0x58) },
-        { 92, std::make_pair(0x90, 0x59) },
-        { 93, std::make_pair(0x90, 0x5A) },
-        { 102, std::make_pair(0x90, 0x3A) },
-        { 103, std::make_pair(0x90, 0x3B) },
-        { 104, std::make_pair(0x90, 0x3C) },
-        { 105, std::make_pair(0x90, 0x3D) },
-        { 106, std::make_pair(0x90, 0x3E) },
-        { 107, std::make_pair(0x90, 0x3F) },
-        { 108, std::make_pair(0x90, 0x40) },
-        { 109, std::make_pair(0x90, 0x41) },
-        { 124, std::make_pair(0xB0, 0x38) },
-        { 125, std::make_pair(0xB0, 0x39) },
-        { 126, std::make_pair(0xB0, 0x3A) },
-        { 127, std::make_pair(0xB0, 0x3B) },
-        { 128, std::make_pair(0xB0, 0x3C) },
-        { 129, std::make_pair(0xB0, 0x3D) },
-        { 130, std::make_pair(0xB0, 0x3E) },
-        { 131, std::make_pair(0xB0, 0x3F) },
-        { 132, std::make_pair(0xB0, 0x30) },
-        { 133, std::make_pair(0xB0, 0x31) },
-        { 134, std::make_pair(0xB0, 0x32) },
-        { 135, std::make_pair(0xB0, 0x33) },
-        { 136, std::make_pair(0xB0, 0x34) },
-        { 137, std::make_pair(0xB0, 0x35) },
-        { 138, std::make_pair(0xB0, 0x36) },
-        { 139, std::make_pair(0xB0, 0x37) },
-        { 140, std::make_pair(0xB0, 0x18) },
-        { 141, std::make_pair(0xB0, 0x19) },
-        { 142, std::make_pair(0xB0, 0x1A) },
-        { 143, std::make_pair(0xB0, 0x1B) },
-        { 144, std::make_pair(0xB0, 0x1C) },
-        { 145, std::make_pair(0xB0, 0x1D) },
-        { 146, std::make_pair(0xB0, 0x1E) },
-        { 147, std::make_pair(0xB0, 0x1F) },
-        { 148, std::make_pair(0xB0, 0x10) },
-        { 149, std::make_pair(0xB0, 0x11) },
-        { 150, std::make_pair(0xB0, 0x12) },
-        { 151, std::make_pair(0xB0, 0x13) },
-        { 152, std::make_pair(0xB0, 0x14) },
-        { 153, std::make_pair(0xB0, 0x15) },
-        { 154, std::make_pair(0xB0, 0x16) },
-        { 155, std::make_pair(0xB0, 0x17) },
+        if (!APC40_BUTTON_INPUT_MASK.Test(i))
+            return;
+
+        uint64_t bit{ uint64_t{ 1 } << (i & 63) };
+        uint64_t pressed{ m_InputPressed[i >> 6].load(std::memory_order_relaxed) };
+        uint64_t updated{ input_message.pressed ? pressed | bit : pressed & ~bit };
+
+        if (updated == pressed)
+            return;
+
+        m_InputPressed[i >> 6].store(updated, std::memory_order_relaxed);
+        m_InputEdges[i].store(m_InputEdges[i].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    struct MessageWriter
+    {
+        unsigned char* buffer = nullptr;
+        size_t buffer_size = 0;
+        bool running_status = false;
+
+        APC40MidiFlush& flush;
+
+        unsigned char status_last = 0;
     };
+
+    // The flush works on the desired state, or on the last published frame in frame mode.
+    const unsigned char* GetFlushState() const
+    {
+        return m_FrameMode ? m_Frames[m_FrameReadSlot] : m_DesiredState;
+    }
+
+    void BeginFlush(APC40MidiFlush& flush)
+    {
+        if (m_ConcurrentMode)
+            ClaimMailbox();
+
+        // Pick up the latest published frame. Its changes are found by diffing all controls.
+        if (m_FrameMode && (m_FrameExchange.load(std::memory_order_relaxed) & ms_FrameNew))
+        {
+            m_FrameReadSlot = m_FrameExchange.exchange(m_FrameReadSlot, std::memory_order_acq_rel) & ~ms_FrameNew;
+            m_DirtyMask = APC40_OUTPUT_CONTROL_MASK;
+        }
+
+        flush.size = 0;
+        flush.num_messages = 0;
+        flush.num_saved_bytes = 0;
+        flush.dirty = m_DirtyMask;
+        flush.changes = flush.dirty.Any() ? APC40DiffStates(m_CurrentState, GetFlushState()) & flush.dirty : APC40ControlMask{};
+    }
+
+    // Writes the messages of all controls in mask in ascending order. Returns false once a message doesn't fit into the buffer.
+    bool WriteMessages(MessageWriter& writer, const APC40ControlMask& mask) const
+    {
+        APC40MidiFlush& flush{ writer.flush };
+        const unsigned char* state{ GetFlushState() };
+
+        for (size_t w = 0; w < APC40_CONTROL_MASK_WORDS; ++w)
+        {
+            for (uint64_t bits{ mask.words[w] }; bits != 0; bits &= bits - 1)
+            {
+                size_t i{ w * 64 + APC40CountTrailingZeros(bits) };
+
+                const APC40MidiAddress& address{ ms_ControlOutputTable[i] };
+
+                bool send_status{ !writer.running_status || address.status != writer.status_last };
+
+                if (flush.size + (send_status ? 3 : 2) > writer.buffer_size)
+                    return false;
+
+                if (send_status)
+                {
+                    writer.buffer[flush.size++] = address.status;
+                    writer.status_last = address.status;
+                }
+                else
+                {
+                    ++flush.num_saved_bytes;
+                }
+
+                writer.buffer[flush.size++] = address.data1;
+                writer.buffer[flush.size++] = state[i];
+
+                flush.controls[flush.num_messages] = static_cast<unsigned char>(i);
+                flush.values[flush.num_messages] = state[i];
+                flush.message_ends[flush.num_messages] = static_cast<unsigned short>(flush.size);
+
+                ++flush.num_messages;
+            }
+        }
+
+        return true;
+    }
+
+    // Writes the messages of all controls in mask, grouped by status byte if requested. Returns false once the buffer is full.
+    bool WriteMessageGroup(MessageWriter& writer, const APC40ControlMask& mask) const
+    {
+        if (m_MessageOrder == eAPC40MessageOrder::Status)
+        {
+            for (const APC40StatusGroup& group : APC40_OUTPUT_STATUS_GROUPS)
+            {
+                if (!WriteMessages(writer, mask & group.mask))
+                    return false;
+            }
+
+            return true;
+        }
+
+        return WriteMessages(writer, mask);
+    }
+
+    // Moves the values set since the last claim from the mailbox into the desired state.
+    void ClaimMailbox()
+    {
+        for (size_t w = 0; w < APC40_CONTROL_MASK_WORDS; ++w)
+        {
+            uint64_t claimed{ m_MailboxDirty[w].exchange(0, std::memory_order_acquire) };
+
+            for (uint64_t bits{ claimed }; bits != 0; bits &= bits - 1)
+            {
+                size_t i{ w * 64 + APC40CountTrailingZeros(bits) };
+
+                m_DesiredState[i] = m_Mailbox[i].load(std::memory_order_relaxed);
+            }
+
+            m_DirtyMask.words[w] |= claimed & APC40_OUTPUT_CONTROL_MASK.words[w];
+        }
+    }
+
+    unsigned char GetDesiredState(size_t index) const
+    {
+        return m_ConcurrentMode ? m_Mailbox[index].load(std::memory_order_relaxed) : m_DesiredState[index];
+    }
+
+    // Bulk version of SetDesiredState for count consecutive controls.
+    void SetDesiredStateRange(size_t first, const unsigned char* values, size_t count)
+    {
+        if (m_ConcurrentMode)
+        {
+            for (size_t n = 0; n < count; ++n)
+                m_Mailbox[first + n].store(values[n], std::memory_order_relaxed);
+
+            MarkMailboxRange(first, count);
+
+            return;
+        }
+
+        memcpy(m_DesiredState + first, values, count);
+
+        if (!m_FrameMode)
+            m_DirtyMask |= APC40ControlMaskFrom(first) & ~APC40ControlMaskFrom(first + count) & APC40_OUTPUT_CONTROL_MASK;
+    }
+
+    void FillDesiredStateRange(size_t first, unsigned char value, size_t count)
+    {
+        if (m_ConcurrentMode)
+        {
+            for (size_t n = 0; n < count; ++n)
+                m_Mailbox[first + n].store(value, std::memory_order_relaxed);
+
+            MarkMailboxRange(first, count);
+
+            return;
+        }
+
+        memset(m_DesiredState + first, value, count);
+
+        if (!m_FrameMode)
+            m_DirtyMask |= APC40ControlMaskFrom(first) & ~APC40ControlMaskFrom(first + count) & APC40_OUTPUT_CONTROL_MASK;
+    }
+
+    void MarkMailboxRange(size_t first, size_t count)
+    {
+        APC40ControlMask range{ APC40ControlMaskFrom(first) & ~APC40ControlMaskFrom(first + count) };
+
+        for (size_t w = 0; w < APC40_CONTROL_MASK_WORDS; ++w)
+        {
+            if (range.words[w] != 0)
+                m_MailboxDirty[w].fetch_or(range.words[w], std::memory_order_release);
+        }
+    }
+
+    // Controls without an output message are never marked dirty.
+    // In frame mode the dirty mask belongs to the flush thread, published frames are diffed as a whole instead.
+    void SetDesiredState(size_t index, unsigned char value)
+    {
+        if (m_ConcurrentMode)
+        {
+            m_Mailbox[index].store(value, std::memory_order_relaxed);
+            m_MailboxDirty[index >> 6].fetch_or(uint64_t{ 1 } << (index & 63), std::memory_order_release);
+
+            return;
+        }
+
+        m_DesiredState[index] = value;
+
+        if (!m_FrameMode)
+            m_DirtyMask.words[index >> 6] |= (uint64_t{ 1 } << (index & 63)) & APC40_OUTPUT_CONTROL_MASK.words[index >> 6];
+    }
+
+    alignas(APC40_STATE_ALIGNMENT) unsigned char m_LocalCurrentState[APC40_STATE_SIZE];
+    alignas(APC40_STATE_ALIGNMENT) unsigned char m_LocalDesiredState[APC40_STATE_SIZE];
+
+    // Point to the local state or to the external state passed to AttachState.
+    unsigned char* m_CurrentState{ m_LocalCurrentState };
+    unsigned char* m_DesiredState{ m_LocalDesiredState };
+
+    // Controls that may differ between current and desired state.
+    APC40ControlMask m_DirtyMask;
+
+    eAPC40MessageOrder m_MessageOrder{ eAPC40MessageOrder::Control };
+
+    // Concurrent mode mailbox, written by any thread and claimed by the flush.
+    bool m_ConcurrentMode{ false };
+    std::atomic<unsigned char> m_Mailbox[APC40_NUM_CONTROLS]{};
+    std::atomic<uint64_t> m_MailboxDirty[APC40_CONTROL_MASK_WORDS]{};
+
+    // Frame mode triple buffer. The render thread owns the write slot, the flush owns the read slot,
+    // the third slot is handed over through m_FrameExchange (slot index | ms_FrameNew if it holds an unread frame).
+    static constexpr unsigned int ms_FrameNew = 4;
+
+    bool m_FrameMode{ false };
+    alignas(APC40_STATE_ALIGNMENT) unsigned char m_Frames[3][APC40_STATE_SIZE]{};
+    unsigned int m_FrameWriteSlot{ 0 };
+    unsigned int m_FrameReadSlot{ 1 };
+    std::atomic<unsigned int> m_FrameExchange{ 2 };
+
+    // Number of flushes a dirty control was left pending, see GetPrioritizedMidiMessages.
+    unsigned char m_PendingAge[APC40_STATE_SIZE]{};
+    APC40ControlMask m_AgedMask;
+    size_t m_AgedCursor{ 0 };
+
+    // Input state, written by the translating thread only. Odd sequence numbers mark an update in progress.
+    std::atomic<uint32_t> m_InputSequence{ 0 };
+    std::atomic<uint64_t> m_InputPressed[APC40_CONTROL_MASK_WORDS]{};
+    std::atomic<unsigned char> m_InputValues[APC40_NUM_CONTROLS]{};
+    std::atomic<uint32_t> m_InputEdges[APC40_NUM_CONTROLS]{};
+
+    // Input filters and the last passed value, time and pressed state per control.
+    APC40InputFilter m_InputFilters[APC40_NUM_CONTROLS]{};
+    APC40ControlMask m_InputFilterMask;
+    APC40ControlMask m_InputFilterTimedMask;
+    APC40ControlMask m_InputFilterPassed;
+    APC40ControlMask m_InputFilterPressed;
+
+    // Messages held back by debounce or min_interval, see PollInputFilters.
+    APC40ControlMask m_InputFilterPending;
+    APC40ControlMask m_InputFilterPendingPressed;
+    unsigned char m_InputFilterPendingValues[APC40_NUM_CONTROLS]{};
+    unsigned char m_InputFilterValues[APC40_NUM_CONTROLS]{};
+    uint32_t m_InputFilterTimes[APC40_NUM_CONTROLS]{};
+
+    // Indexed by status byte and first data byte, see APC40InputTableIndex.
+    static constexpr std::array<unsigned char, APC40_INPUT_TABLE_SIZE + APC40_INPUT_TABLE_PADDING> ms_ControlInputTable{ APC40BuildInputTable() };
+
+    // Indexed by control, unmapped controls have a status of 0.
+    static constexpr std::array<APC40MidiAddress, static_cast<size_t>(eAPC40Control::MaxValue)> ms_ControlOutputTable{ APC40_OUTPUT_TABLE };
 };
 
 // ------------------------------------------------------------ EOF
\ No newline at end of file
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// ------------------------------------------------------------
+/*
+
+Minimal memory mapped file, used by APC40PersistentState and APC40Clip.
+
+*/
+// ------------------------------------------------------------
+
+class APC40MappedFile
+{
+public:
+
+    APC40MappedFile()
+    {
+
+    }
+
+    ~APC40MappedFile()
+    {
+        Close();
+    }
+
+    APC40MappedFile(const APC40MappedFile&) = delete;
+    APC40MappedFile& operator=(const APC40MappedFile&) = delete;
+
+    // Maps a file into memory.
+    // If writable is true, the file is created if necessary and resized to size bytes.
+    // Otherwise the existing file is mapped read only and size is ignored.
+    bool Open(const char* path, size_t size, bool writable)
+    {
+        Close();
+
+#if defined _WIN32
+        m_File = CreateFileA(path, writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ, nullptr, writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        if (m_File == INVALID_HANDLE_VALUE)
+            return false;
+
+        if (!writable)
+        {
+            LARGE_INTEGER file_size;
+
+            if (!GetFileSizeEx(m_File, &file_size))
+            {
+                Close();
+                return false;
+            }
+
+            size = static_cast<size_t>(file_size.QuadPart);
+        }
+
+        if (size == 0)
+        {
+            Close();
+            return false;
+        }
+
+        m_Mapping = CreateFileMappingA(m_File, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, static_cast<DWORD>(static_cast<unsigned long long>(size) >> 32), static_cast<DWORD>(size & 0xFFFFFFFF), nullptr);
+
+        if (!m_Mapping)
+        {
+            Close();
+            return false;
+        }
+
+        m_Data = MapViewOfFile(m_Mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+#else
+        m_File = open(path, writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+
+        if (m_File < 0)
+            return false;
+
+        if (writable)
+        {
+            if (ftruncate(m_File, static_cast<off_t>(size)) != 0)
+            {
+                Close();
+                return false;
+            }
+        }
+        else
+        {
+            struct stat file_stat;
+
+            if (fstat(m_File, &file_stat) != 0)
+            {
+                Close();
+                return false;
+            }
+
+            size = static_cast<size_t>(file_stat.st_size);
+        }
+
+        if (size == 0)
+        {
+            Close();
+            return false;
+        }
+
+        m_Data = mmap(nullptr, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, m_File, 0);
+
+        if (m_Data == MAP_FAILED)
+            m_Data = nullptr;
+#endif
+
+        if (!m_Data)
+        {
+            Close();
+            return false;
+        }
+
+        m_Size = size;
+        m_Writable = writable;
+
+        return true;
+    }
+
+    void Close()
+    {
+#if defined _WIN32
+        if (m_Data)
+            UnmapViewOfFile(m_Data);
+
+        if (m_Mapping)
+            CloseHandle(m_Mapping);
+
+        if (m_File != INVALID_HANDLE_VALUE)
+            CloseHandle(m_File);
+
+        m_Mapping = nullptr;
+        m_File = INVALID_HANDLE_VALUE;
+#else
+        if (m_Data)
+            munmap(m_Data, m_Size);
+
+        if (m_File >= 0)
+            close(m_File);
+
+        m_File = -1;
+#endif
+
+        m_Data = nullptr;
+        m_Size = 0;
+        m_Writable = false;
+    }
+
+    // Writes changes back to the file. The OS does this on its own eventually, even if the process crashes.
+    bool Sync()
+    {
+        if (!m_Data || !m_Writable)
+            return false;
+
+#if defined _WIN32
+        return FlushViewOfFile(m_Data, m_Size) != 0;
+#else
+        return msync(m_Data, m_Size, MS_SYNC) == 0;
+#endif
+    }
+
+    bool IsOpen() const
+    {
+        return m_Data != nullptr;
+    }
+
+    void* GetData() const
+    {
+        return m_Data;
+    }
+
+    size_t GetSize() const
+    {
+        return m_Size;
+    }
+
+private:
+
+#if defined _WIN32
+    HANDLE m_File{ INVALID_HANDLE_VALUE };
+    HANDLE m_Mapping{ nullptr };
+#else
+    int m_File{ -1 };
+#endif
+
+    void* m_Data{ nullptr };
+    size_t m_Size{ 0 };
+    bool m_Writable{ false };
+};
+
+// ------------------------------------------------------------ EOF
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <utility>
+
+#include "APC40Interface.h"
+
+// ------------------------------------------------------------
+/*
+
+Incremental midi byte stream parser for raw transports (ALSA rawmidi, serial ports, etc).
+
+Chunks of any size can be fed, messages may be split across chunks.
+Running status is supported, realtime bytes (0xF8 - 0xFF) are skipped wherever they appear.
+
+Channel messages are translated with APC40Interface::TranslateInputMessage.
+SysEx messages (ie. the device's replies to the init message) are passed to a separate callback.
+They point into the fed chunk if possible, and into an internal buffer if they span multiple chunks.
+
+Usage:
+
+APC40MidiParser parser;
+
+unsigned char chunk[1024];
+size_t size = YourRead(chunk, sizeof(chunk));
+
+parser.Feed(apc40, chunk, size,
+    [](const APC40Input& input) { ... },
+    [](const unsigned char* sysex, size_t sysex_size) { ... });
+
+*/
+// ------------------------------------------------------------
+
+// SysEx messages spanning multiple chunks are buffered up to this size, longer ones are dropped.
+constexpr size_t APC40_MAX_SYSEX_SIZE = 256;
+
+class APC40MidiParser
+{
+public:
+
+    APC40MidiParser()
+    {
+
+    }
+
+    ~APC40MidiParser()
+    {
+
+    }
+
+    // Forgets any partial message and the running status.
+    void Reset()
+    {
+        m_Status = 0;
+        m_NumDataBytes = 0;
+        m_NumExpectedBytes = 0;
+        m_InSysEx = false;
+        m_SysExSize = 0;
+        m_SysExOverflow = false;
+    }
+
+    // Parses a chunk of midi bytes. Calls on_input(const APC40Input&) for every APC40 input message
+    // and on_sysex(const unsigned char* data, size_t size) for every complete SysEx message (including 0xF0 and 0xF7).
+    // Returns the number of input messages.
+    template <typename InputFunc, typename SysExFunc>
+    unsigned int Feed(APC40Interface& apc40, const unsigned char* data, size_t size, InputFunc&& on_input, SysExFunc&& on_sysex)
+    {
+        unsigned int num_inputs{ 0 };
+
+        // Start of a SysEx message within this chunk, used to pass it without copying
+        const unsigned char* sysex_start{ nullptr };
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            unsigned char byte{ data[i] };
+
+            if (byte >= 0xF8) // Realtime
+            {
+                // A realtime byte splits a SysEx message in this chunk, continue in the buffer
+                if (m_InSysEx && sysex_start)
+                {
+                    AppendSysEx(sysex_start, &data[i] - sysex_start);
+                    sysex_start = nullptr;
+                }
+
+                continue;
+            }
+
+            if (m_InSysEx)
+            {
+                if (byte == 0xF7)
+                {
+                    if (sysex_start)
+                    {
+                        on_sysex(sysex_start, &data[i] - sysex_start + 1);
+                    }
+                    else
+                    {
+                        AppendSysEx(&byte, 1);
+
+                        if (!m_SysExOverflow)
+                            on_sysex(static_cast<const unsigned char*>(m_SysEx), m_SysExSize);
+                    }
+
+                    m_InSysEx = false;
+                    sysex_start = nullptr;
+
+                    continue;
+                }
+
+                if (byte < 0x80)
+                {
+                    if (!sysex_start)
+                        AppendSysEx(&byte, 1);
+
+                    continue;
+                }
+
+                // Any other status byte aborts the SysEx message
+                m_InSysEx = false;
+                sysex_start = nullptr;
+            }
+
+            if (byte == 0xF0)
+            {
+                m_InSysEx = true;
+                m_SysExSize = 0;
+                m_SysExOverflow = false;
+                m_Status = 0;
+
+                sysex_start = &data[i];
+
+                continue;
+            }
+
+            if (byte >= 0x80)
+            {
+                m_NumDataBytes = 0;
+
+                if (byte < 0xF0)
+                {
+                    m_Status = byte;
+                    m_NumExpectedBytes = (byte & 0xF0) == 0xC0 || (byte & 0xF0) == 0xD0 ? 1 : 2;
+                }
+                else
+                {
+                    // System common messages cancel running status, their data bytes are skipped
+                    m_Status = 0;
+                    m_NumExpectedBytes = byte == 0xF2 ? 2 : (byte == 0xF1 || byte == 0xF3 ? 1 : 0);
+                }
+
+                continue;
+            }
+
+            if (m_NumExpectedBytes == 0)
+                continue;
+
+            m_Message[1 + m_NumDataBytes++] = byte;
+
+            if (m_NumDataBytes < m_NumExpectedBytes)
+                continue;
+
+            m_NumDataBytes = 0;
+
+            if (m_Status == 0)
+            {
+                m_NumExpectedBytes = 0;
+                continue;
+            }
+
+            m_Message[0] = m_Status;
+
+            if (m_NumExpectedBytes == 1)
+                m_Message[2] = 0;
+
+            APC40Input input;
+
+            if (apc40.TranslateInputMessage(m_Message, 3, input))
+            {
+                on_input(input);
+                ++num_inputs;
+            }
+        }
+
+        // Keep the unfinished part of a SysEx message for the next chunk
+        if (m_InSysEx && sysex_start)
+            AppendSysEx(sysex_start, data + size - sysex_start);
+
+        return num_inputs;
+    }
+
+    // Same as above, SysEx messages are discarded.
+    template <typename InputFunc>
+    unsigned int Feed(APC40Interface& apc40, const unsigned char* data, size_t size, InputFunc&& on_input)
+    {
+        return Feed(apc40, data, size, std::forward<InputFunc>(on_input), [](const unsigned char*, size_t) {});
+    }
+
+private:
+
+    void AppendSysEx(const unsigned char* data, size_t size)
+    {
+        if (m_SysExSize + size > APC40_MAX_SYSEX_SIZE)
+        {
+            m_SysExOverflow = true;
+            return;
+        }
+
+        memcpy(m_SysEx + m_SysExSize, data, size);
+        m_SysExSize += size;
+    }
+
+    unsigned char m_Status{ 0 };
+    unsigned char m_Message[3]{};
+    unsigned int m_NumDataBytes{ 0 };
+    unsigned int m_NumExpectedBytes{ 0 };
+
+    bool m_InSysEx{ false };
+    bool m_SysExOverflow{ false };
+    size_t m_SysExSize{ 0 };
+    unsigned char m_SysEx[APC40_MAX_SYSEX_SIZE];
+};
+
+// ------------------------------------------------------------ EOF
@@ -0,0 +1,324 @@
+#pragma once
+
+#include "APC40Interface.h"
+
+// ------------------------------------------------------------
+/*
+
+Pad framebuffer stored as bit-planes.
+
+The LED mode of every pad cell (eAPC40LEDMode::Off - YellowBlink) is split into 3 bits, and every
+bit is stored in its own 128 bit plane. Cell (x, y) is bit y * APC40_PAD_SIZE_X + x, which is
+also its index in the interface's state, so planes convert directly to control masks.
+
+Fills, blits, scrolling and masking work on whole planes. Cells that don't exist on the device
+(scene column rows 7-9) are kept, so content can scroll through them, but they are never written.
+
+Usage:
+
+APC40PadFrameBuffer frame;
+
+frame.Fill(eAPC40LEDMode::Off);
+frame.Blit(sprite, sprite.GetLitMask(), x, 0);
+frame.Scroll(-1, 0);
+
+frame.WriteTo(apc40); // Only changed cells are set
+
+*/
+// ------------------------------------------------------------
+
+constexpr int APC40_PAD_NUM_CELLS = APC40_PAD_SIZE_X * APC40_PAD_SIZE_Y;
+constexpr int APC40_PAD_NUM_PLANES = 3;
+
+// One bit per pad cell, cell (x, y) is bit y * APC40_PAD_SIZE_X + x.
+struct APC40PadBits
+{
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    constexpr void Set(int i) { (i < 64 ? lo : hi) |= uint64_t{ 1 } << (i & 63); }
+    constexpr void Reset(int i) { (i < 64 ? lo : hi) &= ~(uint64_t{ 1 } << (i & 63)); }
+    constexpr bool Test(int i) const { return ((i < 64 ? lo : hi) >> (i & 63)) & 1; }
+
+    constexpr bool Any() const { return (lo | hi) != 0; }
+
+    constexpr APC40PadBits& operator&=(const APC40PadBits& other) { lo &= other.lo; hi &= other.hi; return *this; }
+    constexpr APC40PadBits& operator|=(const APC40PadBits& other) { lo |= other.lo; hi |= other.hi; return *this; }
+    constexpr APC40PadBits& operator^=(const APC40PadBits& other) { lo ^= other.lo; hi ^= other.hi; return *this; }
+
+    // Pad controls start at 0, so the bits line up with the first words of a control mask.
+    constexpr APC40ControlMask ToControlMask() const
+    {
+        APC40ControlMask mask{};
+
+        mask.words[0] = lo;
+        mask.words[1] = hi;
+
+        return mask;
+    }
+};
+
+constexpr APC40PadBits operator&(APC40PadBits a, const APC40PadBits& b) { return a &= b; }
+constexpr APC40PadBits operator|(APC40PadBits a, const APC40PadBits& b) { return a |= b; }
+constexpr APC40PadBits operator^(APC40PadBits a, const APC40PadBits& b) { return a ^= b; }
+
+constexpr bool operator==(const APC40PadBits& a, const APC40PadBits& b) { return a.lo == b.lo && a.hi == b.hi; }
+constexpr bool operator!=(const APC40PadBits& a, const APC40PadBits& b) { return !(a == b); }
+
+// Shifts towards higher cells. count must be 0 - 127.
+constexpr APC40PadBits APC40ShiftPadBitsUp(const APC40PadBits& bits, int count)
+{
+    if (count == 0)
+        return bits;
+
+    if (count >= 64)
+        return { 0, bits.lo << (count - 64) };
+
+    return { bits.lo << count, (bits.hi << count) | (bits.lo >> (64 - count)) };
+}
+
+// Shifts towards lower cells. count must be 0 - 127.
+constexpr APC40PadBits APC40ShiftPadBitsDown(const APC40PadBits& bits, int count)
+{
+    if (count == 0)
+        return bits;
+
+    if (count >= 64)
+        return { bits.hi >> (count - 64), 0 };
+
+    return { (bits.lo >> count) | (bits.hi << (64 - count)), bits.hi >> count };
+}
+
+// Cells inside a rectangle, clipped to the pad.
+constexpr APC40PadBits APC40PadRectBits(int x, int y, int width, int height)
+{
+    APC40PadBits bits{};
+
+    for (int py = std::max(y, 0); py < std::min(y + height, APC40_PAD_SIZE_Y); ++py)
+    {
+        for (int px = std::max(x, 0); px < std::min(x + width, APC40_PAD_SIZE_X); ++px)
+            bits.Set(py * APC40_PAD_SIZE_X + px);
+    }
+
+    return bits;
+}
+
+// All cells of the grid, including the ones that don't exist on the device.
+constexpr APC40PadBits APC40_PAD_GRID_BITS{ APC40PadRectBits(0, 0, APC40_PAD_SIZE_X, APC40_PAD_SIZE_Y) };
+
+// Cells with an LED, see APC40Interface::IsValidPadPos.
+constexpr APC40PadBits APC40_PAD_VALID_BITS{ APC40PadRectBits(0, 0, APC40_PAD_SIZE_X - 1, APC40_PAD_SIZE_Y) | APC40PadRectBits(APC40_PAD_SIZE_X - 1, 0, 1, APC40_PAD_NUM_SCENE_ROWS) };
+
+// Moves bits by dx columns and dy rows. Bits moved off the grid are dropped, no bits wrap into the next row.
+constexpr APC40PadBits APC40OffsetPadBits(const APC40PadBits& bits, int dx, int dy)
+{
+    if (dx <= -APC40_PAD_SIZE_X || dx >= APC40_PAD_SIZE_X || dy <= -APC40_PAD_SIZE_Y || dy >= APC40_PAD_SIZE_Y)
+        return {};
+
+    int offset{ dy * APC40_PAD_SIZE_X + dx };
+
+    APC40PadBits moved{ offset >= 0 ? APC40ShiftPadBitsUp(bits, offset) : APC40ShiftPadBitsDown(bits, -offset) };
+
+    // Columns the bits can land in without crossing a row boundary
+    return moved & APC40PadRectBits(dx, 0, APC40_PAD_SIZE_X, APC40_PAD_SIZE_Y);
+}
+
+// ------------------------------------------------------------
+
+class APC40PadFrameBuffer
+{
+public:
+
+    APC40PadFrameBuffer()
+    {
+
+    }
+
+    ~APC40PadFrameBuffer()
+    {
+
+    }
+
+    // ------------------------------------------------------------ Drawing
+
+    void Clear()
+    {
+        for (APC40PadBits& plane : m_Planes)
+            plane = {};
+    }
+
+    void Fill(eAPC40LEDMode mode)
+    {
+        unsigned int value{ ToPlaneValue(mode) };
+
+        for (int p = 0; p < APC40_PAD_NUM_PLANES; ++p)
+            m_Planes[p] = (value >> p) & 1 ? APC40_PAD_GRID_BITS : APC40PadBits{};
+    }
+
+    // Fills the cells in mask.
+    void Fill(const APC40PadBits& mask, eAPC40LEDMode mode)
+    {
+        unsigned int value{ ToPlaneValue(mode) };
+        APC40PadBits cells{ mask & APC40_PAD_GRID_BITS };
+
+        for (int p = 0; p < APC40_PAD_NUM_PLANES; ++p)
+        {
+            if ((value >> p) & 1)
+                m_Planes[p] |= cells;
+            else
+                m_Planes[p] &= Invert(cells);
+        }
+    }
+
+    void FillRect(int x, int y, int width, int height, eAPC40LEDMode mode)
+    {
+        Fill(APC40PadRectBits(x, y, width, height), mode);
+    }
+
+    bool SetCell(int x, int y, eAPC40LEDMode mode)
+    {
+        if (x < 0 || x >= APC40_PAD_SIZE_X || y < 0 || y >= APC40_PAD_SIZE_Y)
+            return false;
+
+        APC40PadBits cell{};
+        cell.Set(y * APC40_PAD_SIZE_X + x);
+
+        Fill(cell, mode);
+
+        return true;
+    }
+
+    eAPC40LEDMode GetCell(int x, int y) const
+    {
+        if (x < 0 || x >= APC40_PAD_SIZE_X || y < 0 || y >= APC40_PAD_SIZE_Y)
+            return eAPC40LEDMode::Off;
+
+        return static_cast<eAPC40LEDMode>(GetCellValue(y * APC40_PAD_SIZE_X + x));
+    }
+
+    // Copies the cells of sprite within sprite_mask, moved by dx columns and dy rows. Other cells are left alone.
+    void Blit(const APC40PadFrameBuffer& sprite, const APC40PadBits& sprite_mask, int dx = 0, int dy = 0)
+    {
+        APC40PadBits mask{ APC40OffsetPadBits(sprite_mask & APC40_PAD_GRID_BITS, dx, dy) };
+        APC40PadBits keep{ Invert(mask) };
+
+        for (int p = 0; p < APC40_PAD_NUM_PLANES; ++p)
+            m_Planes[p] = (m_Planes[p] & keep) | (APC40OffsetPadBits(sprite.m_Planes[p], dx, dy) & mask);
+    }
+
+    // Moves the content by dx columns and dy rows. Cells that are scrolled in are off.
+    void Scroll(int dx, int dy)
+    {
+        for (APC40PadBits& plane : m_Planes)
+            plane = APC40OffsetPadBits(plane, dx, dy);
+    }
+
+    // Switches off all cells outside of mask.
+    void Mask(const APC40PadBits& mask)
+    {
+        for (APC40PadBits& plane : m_Planes)
+            plane &= mask;
+    }
+
+    // ------------------------------------------------------------ Queries
+
+    // Cells set to mode.
+    APC40PadBits GetMask(eAPC40LEDMode mode) const
+    {
+        unsigned int value{ ToPlaneValue(mode) };
+        APC40PadBits mask{ APC40_PAD_GRID_BITS };
+
+        for (int p = 0; p < APC40_PAD_NUM_PLANES; ++p)
+            mask &= (value >> p) & 1 ? m_Planes[p] : Invert(m_Planes[p]);
+
+        return mask;
+    }
+
+    // Cells that aren't off.
+    APC40PadBits GetLitMask() const
+    {
+        return m_Planes[0] | m_Planes[1] | m_Planes[2];
+    }
+
+    const APC40PadBits& GetPlane(int plane) const
+    {
+        return m_Planes[plane];
+    }
+
+    bool operator==(const APC40PadFrameBuffer& other) const
+    {
+        return m_Planes[0] == other.m_Planes[0] && m_Planes[1] == other.m_Planes[1] && m_Planes[2] == other.m_Planes[2];
+    }
+
+    bool operator!=(const APC40PadFrameBuffer& other) const
+    {
+        return !(*this == other);
+    }
+
+    // ------------------------------------------------------------ Output
+
+    // Sets the valid cells that changed since the last WriteTo on the interface. Returns the number of cells set.
+    unsigned int WriteTo(APC40Interface& apc40)
+    {
+        APC40PadBits changed{ m_Invalid ? APC40_PAD_GRID_BITS : APC40PadBits{} };
+
+        for (int p = 0; p < APC40_PAD_NUM_PLANES; ++p)
+            changed |= m_Planes[p] ^ m_Written[p];
+
+        changed &= APC40_PAD_VALID_BITS;
+
+        unsigned int num_cells{ 0 };
+
+        changed.ToControlMask().ForEach([&](size_t i)
+        {
+            apc40.SetControlValue(static_cast<eAPC40Control>(i), static_cast<int>(GetCellValue(static_cast<int>(i))));
+            ++num_cells;
+        });
+
+        for (int p = 0; p < APC40_PAD_NUM_PLANES; ++p)
+            m_Written[p] = m_Planes[p];
+
+        m_Invalid = false;
+
+        return num_cells;
+    }
+
+    // Makes the next WriteTo set all cells, ie. after the interface's pad was changed elsewhere.
+    void Invalidate()
+    {
+        m_Invalid = true;
+    }
+
+private:
+
+    // eAPC40LEDMode::On doesn't fit into the planes. It's stored as Green, which lights single colour LEDs as well.
+    static unsigned int ToPlaneValue(eAPC40LEDMode mode)
+    {
+        unsigned int value{ static_cast<unsigned int>(mode) };
+
+        return value < (1u << APC40_PAD_NUM_PLANES) ? value : static_cast<unsigned int>(eAPC40LEDMode::Green);
+    }
+
+    static APC40PadBits Invert(const APC40PadBits& bits)
+    {
+        return APC40_PAD_GRID_BITS ^ (bits & APC40_PAD_GRID_BITS);
+    }
+
+    unsigned int GetCellValue(int i) const
+    {
+        unsigned int value{ 0 };
+
+        for (int p = 0; p < APC40_PAD_NUM_PLANES; ++p)
+            value |= static_cast<unsigned int>(m_Planes[p].Test(i)) << p;
+
+        return value;
+    }
+
+    APC40PadBits m_Planes[APC40_PAD_NUM_PLANES];
+
+    // Planes as of the last WriteTo.
+    APC40PadBits m_Written[APC40_PAD_NUM_PLANES];
+    bool m_Invalid{ true };
+};
+
+// ------------------------------------------------------------ EOF
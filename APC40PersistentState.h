@@ -0,0 +1,239 @@
+#pragma once
+
+#include "APC40Interface.h"
+#include "APC40MappedFile.h"
+
+// ------------------------------------------------------------
+/*
+
+Keeps the state of an APC40Interface in a memory mapped file.
+
+When the process restarts, the new interface resumes with the state of the previous one and
+only sends what actually differs, instead of redrawing the whole device.
+
+The file holds a small header (magic, version, state size, checksum of the current state)
+followed by the current and desired state. A file that doesn't validate is reset, which
+falls back to the usual full redraw.
+
+Usage:
+
+APC40PersistentState persistent_state;
+persistent_state.Open("apc40.state");
+persistent_state.Attach(apc40);
+
+// ...
+
+size_t size = apc40.PrepareMidiMessages(buffer, buffer_size, true, flush);
+persistent_state.BeginSend(flush);
+
+size_t bytes_sent = YourWrite(buffer, size);
+
+apc40.CommitMidiMessages(flush, bytes_sent);
+persistent_state.Seal();
+
+*/
+// ------------------------------------------------------------
+
+constexpr uint32_t APC40_PERSISTENT_STATE_MAGIC = 0x53435041; // "APCS"
+constexpr uint32_t APC40_PERSISTENT_STATE_VERSION = 1;
+
+struct APC40PersistentStateHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t state_size;
+    uint32_t checksum; // Of the current state
+};
+
+// The header is followed by the current and the desired state, both aligned like the interface's state.
+constexpr size_t APC40_PERSISTENT_STATE_OFFSET = (sizeof(APC40PersistentStateHeader) + APC40_STATE_ALIGNMENT - 1) / APC40_STATE_ALIGNMENT * APC40_STATE_ALIGNMENT;
+constexpr size_t APC40_PERSISTENT_STATE_FILE_SIZE = APC40_PERSISTENT_STATE_OFFSET + APC40_STATE_SIZE * 2;
+
+// 32 bit FNV-1a
+inline uint32_t APC40Checksum(const unsigned char* data, size_t size)
+{
+    uint32_t hash{ 2166136261u };
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// ------------------------------------------------------------
+
+class APC40PersistentState
+{
+public:
+
+    APC40PersistentState()
+    {
+
+    }
+
+    ~APC40PersistentState()
+    {
+        Close();
+    }
+
+    APC40PersistentState(const APC40PersistentState&) = delete;
+    APC40PersistentState& operator=(const APC40PersistentState&) = delete;
+
+    // Opens or creates the state file. A file with a valid header and checksum is resumed (see IsResumed).
+    bool Open(const char* path)
+    {
+        Close();
+
+        if (!m_File.Open(path, APC40_PERSISTENT_STATE_FILE_SIZE, true))
+            return false;
+
+        m_Resumed = Validate();
+
+        if (!m_Resumed)
+        {
+            APC40PersistentStateHeader& header{ GetHeader() };
+
+            header.magic = APC40_PERSISTENT_STATE_MAGIC;
+            header.version = APC40_PERSISTENT_STATE_VERSION;
+            header.state_size = static_cast<uint32_t>(APC40_STATE_SIZE);
+
+            memset(GetCurrentState(), 0, APC40_STATE_SIZE);
+            memset(GetCurrentState(), 255, APC40_NUM_CONTROLS);
+            memset(GetDesiredState(), 0, APC40_STATE_SIZE);
+
+            Seal();
+        }
+
+        return true;
+    }
+
+    // Detaches the interface, seals the file and unmaps it.
+    void Close()
+    {
+        if (!m_File.IsOpen())
+            return;
+
+        Detach();
+        Seal();
+
+        m_File.Sync();
+        m_File.Close();
+
+        m_Resumed = false;
+    }
+
+    // True if Open found the state of a previous process.
+    bool IsResumed() const
+    {
+        return m_Resumed;
+    }
+
+    // Moves the interface's state into the file.
+    // If the file was resumed, the interface continues with the stored state. Otherwise the file takes over the interface's desired state.
+    // The interface has to outlive the attachment (or be detached first).
+    bool Attach(APC40Interface& apc40)
+    {
+        if (!m_File.IsOpen())
+            return false;
+
+        Detach();
+
+        if (!m_Resumed)
+        {
+            for (size_t i = 0; i < APC40_NUM_CONTROLS; ++i)
+            {
+                int value{ 0 };
+
+                apc40.GetControlValue(static_cast<eAPC40Control>(i), value);
+
+                GetDesiredState()[i] = static_cast<unsigned char>(value);
+            }
+        }
+
+        apc40.AttachState(GetCurrentState(), GetDesiredState());
+
+        m_Interface = &apc40;
+
+        return true;
+    }
+
+    // Copies the state back into the interface.
+    void Detach()
+    {
+        if (!m_Interface)
+            return;
+
+        m_Interface->AttachState(nullptr, nullptr);
+        m_Interface = nullptr;
+    }
+
+    // Call this right before sending a prepared flush. Its controls are marked as unknown until
+    // CommitMidiMessages updates them, so a crash while sending can't leave a state the device may not have.
+    void BeginSend(const APC40MidiFlush& flush)
+    {
+        if (!m_File.IsOpen())
+            return;
+
+        for (unsigned int n = 0; n < flush.num_messages; ++n)
+            GetCurrentState()[flush.controls[n]] = 255;
+
+        Seal();
+    }
+
+    // Stores the checksum of the current state. Call this after CommitMidiMessages or GetMidiMessages.
+    // If the process dies between a state update and the next Seal, the file is reset when opened again.
+    void Seal()
+    {
+        if (!m_File.IsOpen())
+            return;
+
+        GetHeader().checksum = APC40Checksum(GetCurrentState(), APC40_STATE_SIZE);
+    }
+
+private:
+
+    APC40PersistentStateHeader& GetHeader()
+    {
+        return *static_cast<APC40PersistentStateHeader*>(m_File.GetData());
+    }
+
+    unsigned char* GetCurrentState()
+    {
+        return static_cast<unsigned char*>(m_File.GetData()) + APC40_PERSISTENT_STATE_OFFSET;
+    }
+
+    unsigned char* GetDesiredState()
+    {
+        return GetCurrentState() + APC40_STATE_SIZE;
+    }
+
+    bool Validate()
+    {
+        const APC40PersistentStateHeader& header{ GetHeader() };
+
+        if (header.magic != APC40_PERSISTENT_STATE_MAGIC ||
+            header.version != APC40_PERSISTENT_STATE_VERSION ||
+            header.state_size != APC40_STATE_SIZE ||
+            header.checksum != APC40Checksum(GetCurrentState(), APC40_STATE_SIZE))
+        {
+            return false;
+        }
+
+        // The desired state isn't covered by the checksum, it only needs to be in range
+        unsigned char* desired_state{ GetDesiredState() };
+
+        for (size_t i = 0; i < APC40_STATE_SIZE; ++i)
+            desired_state[i] = i < APC40_NUM_CONTROLS ? std::min<unsigned char>(desired_state[i], 127) : 0;
+
+        return true;
+    }
+
+    APC40MappedFile m_File;
+    APC40Interface* m_Interface{ nullptr };
+    bool m_Resumed{ false };
+};
+
+// ------------------------------------------------------------ EOF
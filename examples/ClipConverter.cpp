@@ -0,0 +1,88 @@
+/*
+Converts a capture of SetControlValue calls into a clip (see APC40Clip.h).
+
+The capture is a text file with one call per line:
+
+<time in ms> <control index> <value>
+
+ie. written by logging calls like this:
+
+fprintf(capture, "%u %d %d\n", now, static_cast<int>(control), value);
+
+Lines must be sorted by time. Every frame contains the values of all calls up to its end.
+
+Usage:
+
+ClipConverter <capture.txt> <output.apc40clip> [fps = 60] [keyframe interval = 60]
+
+Build:
+
+g++ -std=c++17 -O2 -I.. ClipConverter.cpp -o ClipConverter
+
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <APC40Clip.h>
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: ClipConverter <capture.txt> <output.apc40clip> [fps] [keyframe interval]" << std::endl;
+        return 1;
+    }
+
+    uint32_t fps{ argc > 3 ? static_cast<uint32_t>(std::stoul(argv[3])) : 60u };
+    uint32_t keyframe_interval{ argc > 4 ? static_cast<uint32_t>(std::stoul(argv[4])) : 60u };
+
+    if (fps == 0)
+    {
+        std::cerr << "Invalid fps" << std::endl;
+        return 1;
+    }
+
+    std::ifstream capture{ argv[1] };
+
+    if (!capture)
+    {
+        std::cerr << "Failed to open " << argv[1] << std::endl;
+        return 1;
+    }
+
+    APC40ClipRecorder recorder;
+    recorder.Begin(1000000 / fps, keyframe_interval);
+
+    uint64_t time;
+    int control;
+    int value;
+    size_t num_calls{ 0 };
+    size_t num_rejected{ 0 };
+
+    while (capture >> time >> control >> value)
+    {
+        // Finish all frames that end before this call
+        uint64_t frame{ time * fps / 1000 };
+
+        while (recorder.GetNumFrames() < frame)
+            recorder.EndFrame();
+
+        if (recorder.SetControlValue(static_cast<eAPC40Control>(control), value))
+            ++num_calls;
+        else
+            ++num_rejected;
+    }
+
+    recorder.EndFrame();
+
+    if (!recorder.Save(argv[2]))
+    {
+        std::cerr << "Failed to write " << argv[2] << std::endl;
+        return 1;
+    }
+
+    std::cout << num_calls << " calls (" << num_rejected << " rejected) -> " << recorder.GetNumFrames() << " frames" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+/*
+Benchmark for the state diff kernels.
+
+Compares APC40DiffStatesScalar against APC40DiffStates (SSE2/AVX2, depending on compiler flags)
+at 0%, 10% and 100% change density.
+
+Build with optimizations, ie.:
+
+g++ -std=c++17 -O2 -mavx2 -I.. DiffBenchmark.cpp -o DiffBenchmark
+
+*/
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <APC40Interface.h>
+
+constexpr int NUM_ITERATIONS = 1000000;
+
+template <typename Func>
+double MeasureNanoseconds(Func&& func, const unsigned char* a, const unsigned char* b, uint64_t& checksum)
+{
+    auto start{ std::chrono::steady_clock::now() };
+
+    for (int i = 0; i < NUM_ITERATIONS; ++i)
+    {
+        APC40ControlMask mask{ func(a, b) };
+
+        checksum += mask.words[i % APC40_CONTROL_MASK_WORDS];
+    }
+
+    auto end{ std::chrono::steady_clock::now() };
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / NUM_ITERATIONS;
+}
+
+int main()
+{
+    alignas(APC40_STATE_ALIGNMENT) unsigned char current[APC40_STATE_SIZE]{};
+    alignas(APC40_STATE_ALIGNMENT) unsigned char desired[APC40_STATE_SIZE]{};
+
+#if defined APC40_SIMD_AVX2
+    std::cout << "SIMD path: AVX2\n";
+#elif defined APC40_SIMD_SSE2
+    std::cout << "SIMD path: SSE2\n";
+#else
+    std::cout << "SIMD path: none (scalar fallback)\n";
+#endif
+
+    const int densities[] = { 0, 10, 100 };
+
+    uint64_t checksum{ 0 };
+
+    for (int density : densities)
+    {
+        for (size_t i = 0; i < APC40_NUM_CONTROLS; ++i)
+        {
+            current[i] = static_cast<unsigned char>(rand() % 128);
+            desired[i] = (rand() % 100 < density) ? static_cast<unsigned char>((current[i] + 1) % 128) : current[i];
+        }
+
+        double scalar_ns{ MeasureNanoseconds(APC40DiffStatesScalar, current, desired, checksum) };
+        double simd_ns{ MeasureNanoseconds(APC40DiffStates, current, desired, checksum) };
+
+        std::cout << density << "% changed - scalar: " << scalar_ns << " ns, simd: " << simd_ns << " ns\n";
+    }
+
+    std::cout << "(checksum " << checksum << ")\n";
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+Regression tests for APC40Compositor.
+
+Build and run:
+
+g++ -std=c++17 -I.. CompositorTest.cpp -o CompositorTest && ./CompositorTest
+
+*/
+
+#include <iostream>
+#include <APC40Compositor.h>
+
+static int g_NumFailed = 0;
+
+static void Check(bool condition, const char* name)
+{
+    if (!condition)
+    {
+        std::cerr << "FAILED: " << name << std::endl;
+        ++g_NumFailed;
+    }
+}
+
+static int GetValue(APC40Interface& apc40, eAPC40Control control)
+{
+    int value{ -1 };
+    apc40.GetControlValue(control, value);
+    return value;
+}
+
+// A control the removed layer cleared before removal must fall back to the layer below.
+static void TestClearThenRemove()
+{
+    APC40Interface apc40;
+    APC40Compositor compositor;
+
+    eAPC40Control control{ APC40PackControl(eAPC40Control::Pad, 0, 0) };
+
+    APC40Layer* base{ compositor.AddLayer(0) };
+    APC40Layer* top{ compositor.AddLayer(1) };
+
+    base->SetControlValue(control, 1);
+    top->SetControlValue(control, 3);
+    compositor.Compose(apc40);
+
+    Check(GetValue(apc40, control) == 3, "top layer is shown");
+
+    top->ClearControl(control);
+    compositor.RemoveLayer(top);
+    compositor.Compose(apc40);
+
+    Check(GetValue(apc40, control) == 1, "cleared then removed layer falls back to base");
+}
+
+static void TestRemoveUncovers()
+{
+    APC40Interface apc40;
+    APC40Compositor compositor;
+
+    eAPC40Control control{ APC40PackControl(eAPC40Control::Pad, 1, 0) };
+
+    APC40Layer* top{ compositor.AddLayer(1) };
+
+    top->SetControlValue(control, 5);
+    compositor.Compose(apc40);
+
+    compositor.RemoveLayer(top);
+    compositor.Compose(apc40);
+
+    Check(GetValue(apc40, control) == 0, "removed layer falls back to off");
+}
+
+int main()
+{
+    TestClearThenRemove();
+    TestRemoveUncovers();
+
+    if (g_NumFailed == 0)
+        std::cout << "All tests passed" << std::endl;
+
+    return g_NumFailed == 0 ? 0 : 1;
+}
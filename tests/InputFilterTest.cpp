@@ -0,0 +1,174 @@
+/*
+Regression tests for the input filters of APC40Interface.
+
+Build and run:
+
+g++ -std=c++17 -I.. InputFilterTest.cpp -o InputFilterTest && ./InputFilterTest
+
+*/
+
+#include <iostream>
+#include <thread>
+#include <APC40Interface.h>
+
+static int g_NumFailed = 0;
+
+static void Check(bool condition, const char* name)
+{
+    if (!condition)
+    {
+        std::cerr << "FAILED: " << name << std::endl;
+        ++g_NumFailed;
+    }
+}
+
+static bool Translate(APC40Interface& apc40, unsigned char b1, unsigned char b2, unsigned char b3)
+{
+    const unsigned char message[3]{ b1, b2, b3 };
+    APC40Input input;
+
+    return apc40.TranslateInputMessage(message, 3, input);
+}
+
+static void Wait(int milliseconds)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+}
+
+static size_t Poll(APC40Interface& apc40, APC40Input& input)
+{
+    APC40Input inputs[APC40_NUM_CONTROLS];
+    size_t count{ apc40.PollInputFilters(inputs, APC40_NUM_CONTROLS) };
+
+    if (count > 0)
+        input = inputs[count - 1];
+
+    return count;
+}
+
+constexpr int DEBOUNCE_MS = 50;
+
+static void SetPadDebounce(APC40Interface& apc40)
+{
+    APC40InputFilter filter;
+    filter.debounce = DEBOUNCE_MS;
+    apc40.SetInputFilter(APC40_PAD_MASK, filter);
+}
+
+// Press/release/press/release/press within the debounce time is a single press.
+static void TestBounce()
+{
+    APC40Interface apc40;
+    SetPadDebounce(apc40);
+
+    eAPC40Control pad{ APC40PackControl(eAPC40Control::Pad, 0, 0) };
+
+    Check(Translate(apc40, 0x90, 0x35, 0x7F), "bounce: first press passes");
+    Check(!Translate(apc40, 0x80, 0x35, 0x00), "bounce: release is dropped");
+    Check(!Translate(apc40, 0x90, 0x35, 0x7F), "bounce: second press is dropped");
+    Check(!Translate(apc40, 0x80, 0x35, 0x00), "bounce: second release is dropped");
+    Check(!Translate(apc40, 0x90, 0x35, 0x7F), "bounce: third press is dropped");
+
+    APC40InputState state;
+    apc40.GetInputState(state);
+
+    Check(state.edges[static_cast<size_t>(pad)] == 1, "bounce: one edge");
+
+    // The bounce ended pressed, nothing is held
+    Wait(DEBOUNCE_MS * 2);
+
+    APC40Input input;
+
+    Check(Poll(apc40, input) == 0, "bounce: nothing to report");
+    Check(apc40.IsInputPressed(pad), "bounce: pad stays pressed");
+}
+
+// A tap shorter than the debounce time reports its release once the time ends.
+static void TestShortTap()
+{
+    APC40Interface apc40;
+    SetPadDebounce(apc40);
+
+    eAPC40Control pad{ APC40PackControl(eAPC40Control::Pad, 0, 0) };
+
+    Check(Translate(apc40, 0x90, 0x35, 0x7F), "tap: press passes");
+    Check(!Translate(apc40, 0x80, 0x35, 0x00), "tap: release is held");
+
+    APC40Input input;
+
+    Check(Poll(apc40, input) == 0, "tap: release is not reported early");
+
+    Wait(DEBOUNCE_MS * 2);
+
+    Check(Poll(apc40, input) == 1 && input.control == pad && !input.pressed, "tap: release is reported");
+    Check(!apc40.IsInputPressed(pad), "tap: pad is released");
+}
+
+// A throttled slider sweep reports its final value once the interval ends.
+static void TestThrottledSweep()
+{
+    APC40Interface apc40;
+
+    APC40InputFilter filter;
+    filter.min_interval = 50;
+    apc40.SetInputFilter(eAPC40Control::VolumeSlider, filter);
+
+    Check(Translate(apc40, 0xB0, 0x07, 40), "sweep: first value passes");
+
+    for (unsigned char value = 41; value <= 60; ++value)
+        Translate(apc40, 0xB0, 0x07, value);
+
+    Check(apc40.GetInputValue(eAPC40Control::VolumeSlider) == 40, "sweep: throttled values are held");
+
+    Wait(100);
+
+    APC40Input input;
+
+    Check(Poll(apc40, input) == 1 && input.value == 60, "sweep: final value is reported");
+    Check(apc40.GetInputValue(eAPC40Control::VolumeSlider) == 60, "sweep: input state has the final value");
+}
+
+// Without a deadband, repeated values pass (the min_interval keeps the filter active).
+static void TestZeroDeadband()
+{
+    APC40Interface apc40;
+
+    APC40InputFilter filter;
+    filter.min_interval = 1;
+    apc40.SetInputFilter(eAPC40Control::VolumeSlider, filter);
+
+    Check(Translate(apc40, 0xB0, 0x07, 40), "deadband 0: first value passes");
+
+    Wait(5);
+
+    Check(Translate(apc40, 0xB0, 0x07, 40), "deadband 0: repeated value passes");
+}
+
+// The relative cue level knob must not lose ticks to the deadband or min_interval.
+static void TestRelativeKnob()
+{
+    APC40Interface apc40;
+
+    APC40InputFilter filter;
+    filter.deadband = 2;
+    filter.min_interval = 1000;
+    apc40.SetInputFilter(eAPC40Control::CueLevelKnob, filter);
+
+    Check(Translate(apc40, 0xB0, 0x2F, 0x01), "cue: first tick passes");
+    Check(Translate(apc40, 0xB0, 0x2F, 0x01), "cue: second tick passes");
+    Check(Translate(apc40, 0xB0, 0x2F, 0x7F), "cue: reverse tick passes");
+}
+
+int main()
+{
+    TestBounce();
+    TestShortTap();
+    TestThrottledSweep();
+    TestZeroDeadband();
+    TestRelativeKnob();
+
+    if (g_NumFailed == 0)
+        std::cout << "All tests passed" << std::endl;
+
+    return g_NumFailed == 0 ? 0 : 1;
+}